@@ -0,0 +1,147 @@
+/*
+Compares keyword recognition by the lexer's perfect hash (Lexer::identifierType) against the switch trie it replaced,
+kept below as trieIdentifierType. The input is identifier heavy: keywords mixed with identifiers that share their first
+characters or their lengths, which is where the trie has to go deepest. Both are timed classifying the same words
+ROUNDS times over and must agree on every one of them.
+
+Build from the repository root:
+    g++ -std=c++17 -O2 lexer.cpp token.cpp bench/keyword_lookup.cpp -o keyword_lookup
+
+Usage: keyword_lookup [words] [rounds]
+*/
+
+#include "../lexer.hh"
+#include <chrono>
+
+static const char *WORDS[] = {
+    "and", "class", "else", "false", "for", "fun", "if", "nil", "or", "print", "return", "super", "this", "true",
+    "var", "while", "android", "classic", "elsewhere", "fals", "format", "funds", "iffy", "nile", "order", "printer",
+    "returned", "superb", "thus", "truth", "variable", "whilst", "a", "x", "count", "index", "total", "value",
+    "name", "node", "tree", "left", "right", "result", "f", "t", "th", "tr", "fa", "fo"};
+
+static TokenType checkKeyword(const char *start, int length, int from, int remaining, const char *rest, TokenType type)
+{
+    if (length == from + remaining && memcmp(start + from, rest, remaining) == 0)
+        return type;
+    return T_ID;
+}
+
+// Lexer::identifierType as it was before the perfect hash
+static TokenType trieIdentifierType(const char *start, int length)
+{
+    switch (start[0])
+    {
+    case 'a':
+        return checkKeyword(start, length, 1, 2, "nd", T_AND);
+    case 'c':
+        return checkKeyword(start, length, 1, 4, "lass", T_CLASS);
+    case 'e':
+        return checkKeyword(start, length, 1, 3, "lse", T_ELSE);
+    case 'f':
+        if (length > 1)
+        {
+            switch (start[1])
+            {
+            case 'a':
+                return checkKeyword(start, length, 2, 3, "lse", T_FALSE);
+            case 'o':
+                return checkKeyword(start, length, 2, 1, "r", T_FOR);
+            case 'u':
+                return checkKeyword(start, length, 2, 1, "n", T_FUN);
+            }
+        }
+        break;
+    case 'i':
+        return checkKeyword(start, length, 1, 1, "f", T_IF);
+    case 'n':
+        return checkKeyword(start, length, 1, 2, "il", T_NIL);
+    case 'o':
+        return checkKeyword(start, length, 1, 1, "r", T_OR);
+    case 'p':
+        return checkKeyword(start, length, 1, 4, "rint", T_PRINT);
+    case 'r':
+        return checkKeyword(start, length, 1, 5, "eturn", T_RETURN);
+    case 's':
+        return checkKeyword(start, length, 1, 4, "uper", T_SUPER);
+    case 't':
+        if (length > 1)
+        {
+            switch (start[1])
+            {
+            case 'h':
+                return checkKeyword(start, length, 2, 2, "is", T_THIS);
+            case 'r':
+                return checkKeyword(start, length, 2, 2, "ue", T_TRUE);
+            }
+        }
+        break;
+    case 'v':
+        return checkKeyword(start, length, 1, 2, "ar", T_VAR);
+    case 'w':
+        return checkKeyword(start, length, 1, 4, "hile", T_WHILE);
+    }
+
+    return T_ID;
+}
+
+int main(int argc, const char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 100;
+
+    // a pseudo random sequence of words, the same every run
+    std::string source;
+    uint32_t state = 12345;
+    for (int i = 0; i < count; i++)
+    {
+        state = state * 1103515245u + 12345u;
+        source += WORDS[(state >> 16) % (sizeof(WORDS) / sizeof(WORDS[0]))];
+        source += ' ';
+    }
+
+    std::vector<Token> words;
+    Lexer lexer(source.c_str());
+    for (Token token = lexer.scanToken(); token.type != T_EOF; token = lexer.scanToken())
+        words.push_back(token);
+
+    long checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (const Token &word : words)
+            checksum += trieIdentifierType(word.start, word.length);
+    }
+    double trieSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (const Token &word : words)
+        {
+            lexer.start = word.start;
+            lexer.current = word.start + word.length;
+            checksum -= lexer.identifierType();
+        }
+    }
+    double hashSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (checksum != 0)
+    {
+        fprintf(stderr, "The trie and the perfect hash disagree\n");
+        return 1;
+    }
+    for (const Token &word : words)
+    {
+        if (trieIdentifierType(word.start, word.length) != word.type)
+        {
+            fprintf(stderr, "The trie and the perfect hash disagree on '%.*s'\n", word.length, word.start);
+            return 1;
+        }
+    }
+
+    double lookups = (double)words.size() * rounds;
+    printf("%zu words x %d rounds\n", words.size(), rounds);
+    printf("%14s %10.2f ns/word\n", "trie", trieSeconds * 1e9 / lookups);
+    printf("%14s %10.2f ns/word\n", "perfect hash", hashSeconds * 1e9 / lookups);
+    return 0;
+}
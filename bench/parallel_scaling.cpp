@@ -0,0 +1,70 @@
+/*
+Measures how script throughput scales with the number of ScriptRunner threads. The same CPU bound script is run
+SCRIPTS times at every thread count from 1 up to the number of hardware threads, and the wall time and speedup over a
+single thread are printed. Since the VMs share nothing the speedup should track the thread count until the cores run out.
+
+Build from the repository root (everything except main.cpp):
+    g++ -std=c++17 -O2 -pthread $(ls *.cpp | grep -v main.cpp) bench/parallel_scaling.cpp -o parallel_scaling
+
+Usage: parallel_scaling [scripts] [loop iterations]
+*/
+
+#include "../runner.hh"
+#include <chrono>
+#include <thread>
+
+static const char *SCRIPT_PATH = "parallel_scaling_bench.simpl";
+
+static void writeScript(int iterations)
+{
+    FILE *file = fopen(SCRIPT_PATH, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not write %s\n", SCRIPT_PATH);
+        exit(74);
+    }
+
+    fprintf(file,
+            "var total = 0;\n"
+            "var name = \"\";\n"
+            "for (var i = 0; i < %d; i = i + 1) {\n"
+            "    total = total + i * 2 - i / 2;\n"
+            "    if (i - (i / 7) * 7 == 0) name = \"k\" + \"v\";\n"
+            "}\n",
+            iterations);
+    fclose(file);
+}
+
+int main(int argc, const char *argv[])
+{
+    int scripts = argc > 1 ? atoi(argv[1]) : 32;
+    int iterations = argc > 2 ? atoi(argv[2]) : 2000000;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    writeScript(iterations);
+    std::vector<std::string> paths(scripts, SCRIPT_PATH);
+
+    printf("%d scripts x %d iterations\n", scripts, iterations);
+    printf("%8s %12s %10s\n", "threads", "seconds", "speedup");
+
+    double baseline = 0;
+    for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
+    {
+        ScriptRunner runner(threads);
+        runner.useCache = false;
+
+        auto start = std::chrono::steady_clock::now();
+        runner.runAll(paths);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (threads == 1)
+            baseline = seconds;
+        printf("%8d %12.3f %9.2fx\n", threads, seconds, baseline / seconds);
+
+        if (threads == maxThreads)
+            break;
+    }
+
+    remove(SCRIPT_PATH);
+    return 0;
+}
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "bytearray.hh"
+#include "bytecodes.hh"
 
 /**
 
@@ -22,4 +23,311 @@ int ByteArray::addConstant(Value value)
 {
     constants.writeValue(value);
     return constants.size() - 1;
+}
+
+// Operand of the instruction at offset, the first two operand bytes as one big endian number for wider instructions
+static uint16_t operandAt(std::vector<uint8_t> &bytes, int offset)
+{
+    int size = instructionSize(bytes[offset]);
+    if (size == 2)
+        return bytes[offset + 1];
+    if (size >= 3)
+        return (uint16_t)(bytes[offset + 1] << 8 | bytes[offset + 2]);
+    return 0;
+}
+
+/**
+
+    @brief Returns where the jump at offset lands.
+    @param offset Offset of an instruction in the ByteArray.
+    @return The offset of the destination, -1 if the instruction is not a jump.
+    */
+int ByteArray::jumpTarget(int offset)
+{
+    switch (bytes[offset])
+    {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+        return offset + 3 + operandAt(bytes, offset);
+    case OP_LOOP:
+        return offset + 3 - operandAt(bytes, offset);
+    case OP_LESS_LOCAL_CONSTANT_JUMP:
+    case OP_GREATER_LOCAL_CONSTANT_JUMP:
+        return offset + 5 + (bytes[offset + 3] << 8 | bytes[offset + 4]);
+    default:
+        return -1;
+    }
+}
+
+/**
+
+    @brief Walks every path through the bytecode and records the depth of the stack at the start of each instruction.
+    The compiler only emits code where every path into an instruction arrives with the same depth.
+    @param entryDepth How many values are already in the frame when the code starts (the callee and its arguments).
+    @return The depth per offset, -1 for offsets that are never reached or are not the start of an instruction.
+    */
+std::vector<int> ByteArray::stackDepths(int entryDepth)
+{
+    std::vector<int> depthAt(bytes.size(), -1);
+    std::vector<std::pair<int, int>> worklist = {{0, entryDepth}};
+
+    while (!worklist.empty())
+    {
+        auto [offset, depth] = worklist.back();
+        worklist.pop_back();
+        if (offset < 0 || offset >= (int)bytes.size() || depthAt[offset] != -1)
+            continue;
+
+        uint8_t op = bytes[offset];
+        int size = instructionSize(op);
+        if (offset + size > (int)bytes.size())
+            continue;
+
+        depthAt[offset] = depth;
+        depth += stackEffect(op, operandAt(bytes, offset));
+
+        int target = jumpTarget(offset);
+        if (target != -1)
+            worklist.push_back({target, depth});
+
+        if (op != OP_RETURN && op != OP_JUMP && op != OP_LOOP)
+            worklist.push_back({offset + size, depth});
+    }
+
+    return depthAt;
+}
+
+/**
+
+    @brief Returns the deepest the stack gets while running the bytecode, see stackDepths().
+    @param entryDepth How many values are already in the frame when the code starts (the callee and its arguments).
+    @return The largest number of values the frame holds at any point.
+    */
+int ByteArray::maxStackDepth(int entryDepth)
+{
+    std::vector<int> depthAt = stackDepths(entryDepth);
+    int maxDepth = entryDepth;
+
+    for (int offset = 0; offset < (int)bytes.size(); offset++)
+    {
+        if (depthAt[offset] == -1)
+            continue;
+        int after = depthAt[offset] + stackEffect(bytes[offset], operandAt(bytes, offset));
+        maxDepth = std::max(maxDepth, std::max(depthAt[offset], after));
+    }
+
+    return maxDepth;
+}
+
+// How many values an instruction reads off the top of the stack, at least as many as it pops
+static int stackInputs(uint8_t instruction, uint16_t operand)
+{
+    switch (instruction)
+    {
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_LOCAL:
+    case OP_SET_GLOBAL:
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_RETURN:
+    case OP_PRINT:
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+        return 1;
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_NOT_EQUAL:
+    case OP_GREATER_EQUAL:
+    case OP_LESS_EQUAL:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+        return 2;
+    case OP_CALL:
+        return operand + 1; // the callee below its arguments
+    default:
+        return 0;
+    }
+}
+
+/**
+
+    @brief Checks that bytecode from outside the compiler, i.e. a cache file, can run without reading or jumping out of
+    bounds. Every reachable instruction has to be a known opcode the compiler or Optimizer emits, with its constant
+    indexes inside the pool, its local slots inside the values the frame holds at that point and its jumps landing on
+    the start of an instruction as decoded from the start of the code. Every path into an instruction has to arrive
+    with the same stack depth, with enough values for the instruction to read, and no path may run off the end of the
+    code.
+    @param entryDepth How many values are already in the frame when the code starts (the callee and its arguments).
+    @return false if the VM could not run the code safely.
+    */
+bool ByteArray::verify(int entryDepth)
+{
+    std::vector<int> depthAt = stackDepths(entryDepth);
+    if (bytes.empty() || depthAt[0] == -1)
+        return false;
+
+    // where decoding from the start puts the instructions, anything else checking the code walks it the same way
+    std::vector<bool> starts(bytes.size(), false);
+    for (int offset = 0; offset < (int)bytes.size(); offset += instructionSize(bytes[offset]))
+        starts[offset] = true;
+
+    int constantCount = constants.size();
+    for (int offset = 0; offset < (int)bytes.size(); offset++)
+    {
+        int depth = depthAt[offset];
+        if (depth == -1)
+            continue;
+        if (!starts[offset])
+            return false;
+
+        // quickened forms are only ever written into running code, never into code that is compiled or cached
+        uint8_t op = bytes[offset];
+        if (op >= OP_ADD_NUM_NUM)
+            return false;
+
+        uint16_t operand = operandAt(bytes, offset);
+        if (depth < stackInputs(op, operand))
+            return false;
+
+        switch (op)
+        {
+        case OP_CONSTANT:
+            if (operand >= constantCount)
+                return false;
+            break;
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+            if (operand >= depth)
+                return false;
+            break;
+        case OP_GET_LOCAL_2:
+            // the second slot may be the one the first get has just pushed
+            if (bytes[offset + 1] >= depth || bytes[offset + 2] > depth)
+                return false;
+            break;
+        case OP_ADD_LOCAL_CONSTANT:
+        case OP_LESS_LOCAL_CONSTANT_JUMP:
+        case OP_GREATER_LOCAL_CONSTANT_JUMP:
+            if (bytes[offset + 1] >= depth || bytes[offset + 2] >= constantCount)
+                return false;
+            break;
+        }
+
+        // stackDepths() only records the first depth an instruction is reached with and nothing for targets that are
+        // out of range or hold a cut off instruction, so comparing every edge against it catches all of those
+        int after = depth + stackEffect(op, operand);
+        int target = jumpTarget(offset);
+        if (target != -1 && (target < 0 || target >= (int)bytes.size() || depthAt[target] != after))
+            return false;
+
+        int next = offset + instructionSize(op);
+        if (op != OP_RETURN && op != OP_JUMP && op != OP_LOOP && (next >= (int)bytes.size() || depthAt[next] != after))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+
+    @brief Returns how many bytes an instruction takes up in the ByteArray, the opcode included.
+    @param instruction The opcode.
+    @return The size of the opcode plus its operands.
+    */
+int instructionSize(uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_CALL:
+        return 2;
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_LOOP:
+    case OP_GET_LOCAL_2:
+    case OP_ADD_LOCAL_CONSTANT:
+        return 3;
+    case OP_LESS_LOCAL_CONSTANT_JUMP:
+    case OP_GREATER_LOCAL_CONSTANT_JUMP:
+        return 5; // slot, constant and a two byte jump
+    default:
+        return 1;
+    }
+}
+
+/**
+
+    @brief Returns how an instruction changes the number of values on the stack, i.e. OP_ADD pops two values and
+    pushes one so its effect is -1.
+    @param instruction The opcode.
+    @param operand The instruction's operand, only OP_CALL's depends on it.
+    @return Values pushed minus values popped.
+    */
+int stackEffect(uint8_t instruction, uint16_t operand)
+{
+    switch (instruction)
+    {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_LOCAL:
+    case OP_GET_GLOBAL:
+        return 1;
+    case OP_GET_LOCAL_2:
+        return 2;
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_NOT_EQUAL:
+    case OP_GREATER_EQUAL:
+    case OP_LESS_EQUAL:
+    case OP_ADD:
+    case OP_ADD_NUM_NUM:
+    case OP_ADD_STR_STR:
+    case OP_ADD_GENERIC:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_RETURN:
+    case OP_PRINT:
+    case OP_POP_JUMP_IF_FALSE:
+        return -1;
+    case OP_CALL:
+        return -operand; // the arguments and the callee are replaced by the result
+    default:
+        return 0;
+    }
+}
+
+/**
+
+    @brief Returns the opcode a quickened instruction was rewritten from, see OP_ADD_NUM_NUM.
+    @param instruction The opcode.
+    @return The generic opcode, instruction itself if it is not a quickened form.
+    */
+uint8_t genericOpcode(uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_ADD_NUM_NUM:
+    case OP_ADD_STR_STR:
+    case OP_ADD_GENERIC:
+        return OP_ADD;
+    default:
+        return instruction;
+    }
 }
\ No newline at end of file
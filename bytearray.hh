@@ -21,6 +21,20 @@ class ByteArray
     void writeByte(uint8_t byte, int line);
 
     int addConstant(Value value);
+
+    int jumpTarget(int offset);
+
+    std::vector<int> stackDepths(int entryDepth);
+
+    int maxStackDepth(int entryDepth);
+
+    bool verify(int entryDepth);
 };
 
+int instructionSize(uint8_t instruction);
+
+int stackEffect(uint8_t instruction, uint16_t operand);
+
+uint8_t genericOpcode(uint8_t instruction);
+
 #endif
\ No newline at end of file
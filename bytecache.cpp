@@ -0,0 +1,416 @@
+#include "bytecache.hh"
+#include "bytecodes.hh"
+#include "object.hh"
+#include "vm.hh"
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BYTECACHE_MMAP
+#endif
+
+static const char CACHE_MAGIC[8] = "SIMPLBC";
+
+enum ConstantTag
+{
+    CONST_NIL,
+    CONST_FALSE,
+    CONST_TRUE,
+    CONST_NUMBER,
+    CONST_STRING,
+    CONST_FUNCTION,
+};
+
+// name length written for the script's unnamed function
+static const uint32_t NO_NAME = UINT32_MAX;
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+// FNV-1a, 64 bit so unrelated sources practically never collide
+static uint64_t hashSource(const char *source)
+{
+    uint64_t hash = FNV_OFFSET;
+    for (const char *c = source; *c != '\0'; c++)
+    {
+        hash ^= (uint8_t)*c;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// The same hash over the bytes of the file, catches files that were damaged after they were written
+static uint64_t checksum(const uint8_t *bytes, size_t length)
+{
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+
+    @brief Bounds checked cursor over the mapped cache file, any read past the end marks the whole file as unusable.
+    */
+class CacheReader
+{
+public:
+    const uint8_t *current;
+    const uint8_t *end;
+    bool ok = true;
+
+    CacheReader(const uint8_t *start, size_t size)
+    {
+        current = start;
+        end = start + size;
+    }
+
+    template <typename T>
+    T read()
+    {
+        T value{};
+        if (!ok || (size_t)(end - current) < sizeof(T))
+        {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, current, sizeof(T));
+        current += sizeof(T);
+        return value;
+    }
+
+    const uint8_t *readBytes(size_t length)
+    {
+        if (!ok || (size_t)(end - current) < length)
+        {
+            ok = false;
+            return NULL;
+        }
+        const uint8_t *bytes = current;
+        current += length;
+        return bytes;
+    }
+};
+
+class CacheWriter
+{
+public:
+    std::vector<uint8_t> buffer;
+
+    template <typename T>
+    void write(T value)
+    {
+        const uint8_t *bytes = (const uint8_t *)&value;
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    void writeBytes(const void *data, size_t length)
+    {
+        const uint8_t *bytes = (const uint8_t *)data;
+        buffer.insert(buffer.end(), bytes, bytes + length);
+    }
+};
+
+ByteCache::ByteCache(VM *vm, const char *sourcePath, const char *source)
+{
+    this->vm = vm;
+    path = std::string(sourcePath) + BYTECACHE_SUFFIX;
+    sourceHash = hashSource(source);
+}
+
+// Fills function from the reader, returns false as soon as anything does not match what writeFunction() writes.
+// function has to be reachable by the collector already, loading its constants allocates.
+static bool readFunction(VM &vm, CacheReader &reader, const std::vector<int> &slots, ObjFunction *function)
+{
+    function->arity = reader.read<uint8_t>();
+    uint32_t nameLength = reader.read<uint32_t>();
+    if (nameLength != NO_NAME)
+    {
+        const char *name = (const char *)reader.readBytes(nameLength);
+        if (name == NULL)
+            return false;
+        function->name = makeString(vm, name, nameLength);
+    }
+
+    std::shared_ptr<ByteArray> bytearray = function->chunk;
+    uint32_t constantCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < constantCount && reader.ok; i++)
+    {
+        switch (reader.read<uint8_t>())
+        {
+        case CONST_NIL:
+            bytearray->addConstant(NIL_VAL);
+            break;
+        case CONST_FALSE:
+            bytearray->addConstant(BOOL_VAL(false));
+            break;
+        case CONST_TRUE:
+            bytearray->addConstant(BOOL_VAL(true));
+            break;
+        case CONST_NUMBER:
+            bytearray->addConstant(NUMBER_VAL(reader.read<double>()));
+            break;
+        case CONST_STRING:
+        {
+            uint32_t length = reader.read<uint32_t>();
+            const char *chars = (const char *)reader.readBytes(length);
+            if (chars == NULL)
+                return false;
+            bytearray->addConstant(OBJ_VAL(makeString(vm, chars, length)));
+            break;
+        }
+        case CONST_FUNCTION:
+        {
+            // added to the pool before it is filled in so it is reachable through function
+            ObjFunction *inner = newFunction(vm);
+            bytearray->addConstant(OBJ_VAL(inner));
+            if (!readFunction(vm, reader, slots, inner))
+                return false;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    uint32_t byteCount = reader.read<uint32_t>();
+    const uint8_t *bytes = reader.readBytes(byteCount);
+    if (bytes == NULL)
+        return false;
+    bytearray->bytes.assign(bytes, bytes + byteCount);
+
+    uint32_t runCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < runCount && reader.ok; i++)
+    {
+        int32_t line = reader.read<int32_t>();
+        uint32_t count = reader.read<uint32_t>();
+        if (count > byteCount - bytearray->lines.size())
+            return false;
+        bytearray->lines.insert(bytearray->lines.end(), count, line);
+    }
+
+    if (!reader.ok || bytearray->lines.size() != byteCount)
+        return false;
+
+    for (uint32_t offset = 0; offset < byteCount; offset += instructionSize(bytearray->bytes[offset]))
+    {
+        uint8_t op = bytearray->bytes[offset];
+        if (op != OP_DEFINE_GLOBAL && op != OP_GET_GLOBAL && op != OP_SET_GLOBAL)
+            continue;
+        if (offset + 2 >= byteCount)
+            return false;
+
+        uint16_t stored = (uint16_t)(bytearray->bytes[offset + 1] << 8 | bytearray->bytes[offset + 2]);
+        if (stored >= slots.size())
+            return false;
+        bytearray->bytes[offset + 1] = (slots[stored] >> 8) & 0xff;
+        bytearray->bytes[offset + 2] = slots[stored] & 0xff;
+    }
+
+    // the source hash only says the file was written for this script, not that its bytes survived intact
+    if (!bytearray->verify(function->arity + 1))
+        return false;
+
+    // measured again rather than trusted from the file, the VM relies on it to stay inside its stack
+    function->maxStack = bytearray->maxStackDepth(function->arity + 1);
+    return true;
+}
+
+// Checks the header and loads the script's function, returns NULL if the file is not a usable cache for this source
+static ObjFunction *readCache(VM &vm, CacheReader &reader, uint64_t sourceHash)
+{
+    uint64_t stored;
+    size_t size = reader.end - reader.current;
+    if (size < sizeof(stored))
+        return NULL;
+    reader.end -= sizeof(stored);
+    memcpy(&stored, reader.end, sizeof(stored));
+    if (checksum(reader.current, size - sizeof(stored)) != stored)
+        return NULL;
+
+    const uint8_t *magic = reader.readBytes(sizeof(CACHE_MAGIC));
+    if (magic == NULL || memcmp(magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0)
+        return NULL;
+    if (reader.read<uint32_t>() != BYTECACHE_VERSION || reader.read<uint64_t>() != sourceHash)
+        return NULL;
+
+    // global slots are handed out per VM, so the slot each name had when the file was written may differ now
+    uint32_t globalCount = reader.read<uint32_t>();
+    std::vector<int> slots;
+    for (uint32_t i = 0; i < globalCount && reader.ok; i++)
+    {
+        uint32_t length = reader.read<uint32_t>();
+        const char *name = (const char *)reader.readBytes(length);
+        if (name == NULL)
+            return NULL;
+
+        int slot = vm.globalSlot(makeString(vm, name, length));
+        if (slot > UINT16_MAX)
+            return NULL;
+        slots.push_back(slot);
+    }
+
+    // kept on the VM stack while loading so the collector sees it and everything hanging off it
+    ObjFunction *script = newFunction(vm);
+    vm.push(OBJ_VAL(script));
+    bool loaded = readFunction(vm, reader, slots, script);
+    vm.pop();
+
+    return loaded ? script : NULL;
+}
+
+/**
+
+    @brief Loads the cached compilation of the source this ByteCache was created for.
+    @return The script's top level function, NULL if there is no usable cache file.
+    */
+ObjFunction *ByteCache::load()
+{
+#ifdef BYTECACHE_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return NULL;
+
+    CacheReader reader((const uint8_t *)mapping, info.st_size);
+    ObjFunction *function = readCache(*vm, reader, sourceHash);
+    munmap(mapping, info.st_size);
+    return function;
+#else
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return NULL;
+
+    std::vector<uint8_t> contents;
+    uint8_t block[4096];
+    size_t read;
+    while ((read = fread(block, 1, sizeof(block), file)) > 0)
+        contents.insert(contents.end(), block, block + read);
+    fclose(file);
+
+    CacheReader reader(contents.data(), contents.size());
+    return readCache(*vm, reader, sourceHash);
+#endif
+}
+
+// Appends function in the layout readFunction() expects, false if it holds a constant that cannot be cached
+static bool writeFunction(CacheWriter &writer, ObjFunction *function)
+{
+    writer.write<uint8_t>(function->arity);
+    if (function->name == NULL)
+        writer.write<uint32_t>(NO_NAME);
+    else
+    {
+        writer.write<uint32_t>(function->name->length);
+        writer.writeBytes(function->name->chars, function->name->length);
+    }
+
+    std::shared_ptr<ByteArray> bytearray = function->chunk;
+    writer.write<uint32_t>(bytearray->constants.size());
+    for (Value &value : bytearray->constants.values)
+    {
+        if (IS_NIL(value))
+            writer.write<uint8_t>(CONST_NIL);
+        else if (IS_BOOL(value))
+            writer.write<uint8_t>(AS_BOOL(value) ? CONST_TRUE : CONST_FALSE);
+        else if (IS_NUMBER(value))
+        {
+            writer.write<uint8_t>(CONST_NUMBER);
+            writer.write<double>(AS_NUMBER(value));
+        }
+        else if (IS_STRING(value))
+        {
+            ObjString *string = AS_STRING(value);
+            writer.write<uint8_t>(CONST_STRING);
+            writer.write<uint32_t>(string->length);
+            writer.writeBytes(string->chars, string->length);
+        }
+        else if (IS_FUNCTION(value))
+        {
+            writer.write<uint8_t>(CONST_FUNCTION);
+            if (!writeFunction(writer, AS_FUNCTION(value)))
+                return false;
+        }
+        else
+            return false;
+    }
+
+    writer.write<uint32_t>(bytearray->bytes.size());
+    writer.writeBytes(bytearray->bytes.data(), bytearray->bytes.size());
+
+    std::vector<std::pair<int32_t, uint32_t>> runs;
+    for (int line : bytearray->lines)
+    {
+        if (!runs.empty() && runs.back().first == line)
+            runs.back().second++;
+        else
+            runs.push_back({line, 1});
+    }
+    writer.write<uint32_t>(runs.size());
+    for (auto &run : runs)
+    {
+        writer.write<int32_t>(run.first);
+        writer.write<uint32_t>(run.second);
+    }
+    return true;
+}
+
+/**
+
+    @brief Writes function, the script's top level, to the cache file. The file is written under a temporary name and
+    renamed into place so a concurrent or interrupted run never sees half a file.
+    @return false if the file could not be written, which is not an error for the caller.
+    */
+bool ByteCache::store(ObjFunction *function)
+{
+    CacheWriter writer;
+    writer.writeBytes(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    writer.write<uint32_t>(BYTECACHE_VERSION);
+    writer.write<uint64_t>(sourceHash);
+
+    writer.write<uint32_t>(vm->globals.size());
+    for (Global &global : vm->globals)
+    {
+        writer.write<uint32_t>(global.name->length);
+        writer.writeBytes(global.name->chars, global.name->length);
+    }
+
+    if (!writeFunction(writer, function))
+        return false;
+    writer.write<uint64_t>(checksum(writer.buffer.data(), writer.buffer.size()));
+
+    // unique per thread (and process where available) so concurrent runs of the same script cannot collide
+    std::string temporary = path + ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+#ifdef BYTECACHE_MMAP
+    temporary += "." + std::to_string(getpid());
+#endif
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (file == NULL)
+        return false;
+
+    bool written = fwrite(writer.buffer.data(), 1, writer.buffer.size(), file) == writer.buffer.size();
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
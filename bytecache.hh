@@ -0,0 +1,46 @@
+#ifndef simpl_bytecache_h
+#define simpl_bytecache_h
+
+#include "bytearray.hh"
+
+class VM;
+class ObjFunction;
+
+// Bump whenever the opcode numbering or the layout of the cache file changes
+#define BYTECACHE_VERSION 3
+
+// The cache for script.simpl is written to script.simplc
+#define BYTECACHE_SUFFIX "c"
+
+/**
+
+    @brief This class reads and writes the compiled form of a script so later runs can skip lexing and compiling it.
+    A cache file is only used if it was written by the same BYTECACHE_VERSION for a source with the same hash.
+    The file holds, in order:
+        header      - "SIMPLBC" magic, version, 64 bit FNV-1a hash of the source
+        globals     - the names of the VM's global slots, so slot operands can be remapped on load
+        function    - the script's top level function
+        checksum    - 64 bit FNV-1a hash of everything before it
+    where each function is written as
+        arity, name - the name's length is NO_NAME for the script
+        constants   - tag + payload per constant, strings are re-interned on load and functions nest recursively
+        bytes       - the bytecode
+        lines       - run-length encoded (line, count) pairs
+    Loading maps the file read-only instead of reading it into a buffer. A file whose checksum does not match, or whose
+    bytecode fails ByteArray::verify(), is ignored and the script compiled again.
+    */
+class ByteCache
+{
+public:
+    VM *vm;
+    std::string path;
+    uint64_t sourceHash;
+
+    ByteCache(VM *vm, const char *sourcePath, const char *source);
+
+    ObjFunction *load();
+
+    bool store(ObjFunction *function);
+};
+
+#endif
\ No newline at end of file
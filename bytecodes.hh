@@ -17,17 +17,33 @@ enum OpCode
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
+    OP_NOT_EQUAL,     // fused OP_EQUAL, OP_NOT
+    OP_GREATER_EQUAL, // fused OP_LESS, OP_NOT
+    OP_LESS_EQUAL,    // fused OP_GREATER, OP_NOT
     OP_ADD,
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
+    OP_CALL,
     OP_RETURN,
     OP_PRINT,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
+    OP_POP_JUMP_IF_FALSE, // fused OP_JUMP_IF_FALSE, OP_POP
     OP_LOOP,
+
+    // superinstructions, only emitted by the Optimizer
+    OP_GET_LOCAL_2,                // fused OP_GET_LOCAL, OP_GET_LOCAL
+    OP_ADD_LOCAL_CONSTANT,         // fused OP_GET_LOCAL, OP_CONSTANT, OP_ADD, OP_SET_LOCAL, OP_POP on the same slot
+    OP_LESS_LOCAL_CONSTANT_JUMP,   // fused OP_GET_LOCAL, OP_CONSTANT, OP_LESS, OP_POP_JUMP_IF_FALSE
+    OP_GREATER_LOCAL_CONSTANT_JUMP, // fused OP_GET_LOCAL, OP_CONSTANT, OP_GREATER, OP_POP_JUMP_IF_FALSE
+
+    // quickened forms of OP_ADD, only written by the VM into code that is running, see OP_ADD in VM::execute()
+    OP_ADD_NUM_NUM, // OP_ADD of two numbers
+    OP_ADD_STR_STR, // OP_ADD of two strings
+    OP_ADD_GENERIC  // OP_ADD that has seen more than one kind of operands, never quickened again
 };
 
 #endif
\ No newline at end of file
@@ -1,7 +1,27 @@
 #ifndef common_h
 #define common_h
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
+// Runs the peephole Optimizer over every compiled ByteArray before the VM executes it
+#define OPTIMIZE_BYTECODE
+// Packs every Value into 8 bytes using NaN-boxing; can also be enabled with -DNAN_BOXING
+// #define NAN_BOXING
+// Collects garbage before every allocation / logs every collection
+// #define DEBUG_STRESS_GC
+// #define DEBUG_LOG_GC
+
+// VM::run dispatches through labels-as-values (threaded code) on compilers that support it,
+// define NO_COMPUTED_GOTO to build the portable switch loop instead
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+// --jit translates bytecode into x86-64 machine code, only built where that is the machine running it; define NO_JIT
+// to leave it out
+#if defined(__x86_64__) && defined(__linux__) && !defined(NO_JIT)
+#define JIT_COMPILER
+#endif
+// Script files are mapped into memory instead of being read into a buffer where mmap exists
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_SOURCES
+#endif
 #define UINT8_COUNT (UINT8_MAX + 1)
 
 #include <stdio.h>
@@ -16,6 +36,7 @@
 #include <functional>
 #include <memory>
 #include <variant>
+#include <algorithm>
 
 using std::string;
 
@@ -4,13 +4,12 @@
 #include "object.hh"
 #include "bytecodes.hh"
 
-#ifdef DEBUG_PRINT_CODE
 #include "debug.hh"
-#endif
+#include "optimizer.hh"
 
 std::shared_ptr<ByteArray> Compiler::currentChunk()
 {
-    return compilingChunk;
+    return current->function->chunk;
 }
 
 //////////////////////////////////////////////////
@@ -19,57 +18,71 @@ std::shared_ptr<ByteArray> Compiler::currentChunk()
 
 /**
 
-    Function to generate rules for different tokens and their corresponding parsing functions, precedence values.
-    The rules are stored in a map named 'rules'.
-    Each token type is associated with three properties:
-        A pointer to the prefix parse function for the token.
-        A pointer to the infix parse function for the token.
-        A precedence value for the token.
-    @return void
+    The Pratt parser's rules for every token type: the prefix parse function, the infix parse function and the infix
+    precedence. Built once at compile time and shared by every Compiler, so starting a compile costs nothing for them.
     */
 
-void Parser::generateRules()
-{
-    rules[T_LPAREN] = {Compiler::grouping, NULL, P_NONE};
-    rules[T_RPAREN] = {NULL, NULL, P_NONE};
-    rules[T_LBRACE] = {NULL, NULL, P_NONE};
-    rules[T_RBRACE] = {NULL, NULL, P_NONE};
-    rules[T_COMMA] = {NULL, NULL, P_NONE};
-    rules[T_DOT] = {NULL, NULL, P_NONE};
-    rules[T_MINUS] = {Compiler::unary, Compiler::binary, P_TERM};
-    rules[T_PLUS] = {NULL, Compiler::binary, P_TERM};
-    rules[T_SEMICOLON] = {NULL, NULL, P_NONE};
-    rules[T_SLASH] = {NULL, Compiler::binary, P_FACTOR};
-    rules[T_STAR] = {NULL, Compiler::binary, P_FACTOR};
-    rules[T_NOT] = {Compiler::unary, NULL, P_NONE};
-    rules[T_DNOTE] = {NULL, Compiler::binary, P_EQUALITY};
-    rules[T_EQ] = {NULL, NULL, P_NONE};
-    rules[T_EQUIV] = {NULL, Compiler::binary, P_EQUALITY};
-    rules[T_GRT] = {NULL, Compiler::binary, P_COMPARISON};
-    rules[T_GRTEQ] = {NULL, Compiler::binary, P_COMPARISON};
-    rules[T_LSS] = {NULL, Compiler::binary, P_COMPARISON};
-    rules[T_LSSEQ] = {NULL, Compiler::binary, P_COMPARISON};
-    rules[T_ID] = {Compiler::variable, NULL, P_NONE};
-    rules[T_STR] = {Compiler::string, NULL, P_NONE};
-    rules[T_NUM] = {Compiler::number, NULL, P_NONE};
-    rules[T_AND] = {NULL, Compiler::and_, P_NONE};
-    rules[T_CLASS] = {NULL, NULL, P_NONE};
-    rules[T_ELSE] = {NULL, NULL, P_NONE};
-    rules[T_FALSE] = {Compiler::literal, NULL, P_NONE};
-    rules[T_FOR] = {NULL, NULL, P_NONE};
-    rules[T_FUN] = {NULL, NULL, P_NONE};
-    rules[T_IF] = {NULL, NULL, P_NONE};
-    rules[T_NIL] = {Compiler::literal, NULL, P_NONE};
-    rules[T_OR] = {NULL, Compiler::or_, P_NONE};
-    rules[T_PRINT] = {NULL, NULL, P_NONE};
-    rules[T_RETURN] = {NULL, NULL, P_NONE};
-    rules[T_SUPER] = {NULL, NULL, P_NONE};
-    rules[T_THIS] = {NULL, NULL, P_NONE};
-    rules[T_TRUE] = {Compiler::literal, NULL, P_NONE};
-    rules[T_VAR] = {NULL, NULL, P_NONE};
-    rules[T_WHILE] = {NULL, NULL, P_NONE};
-    rules[T_ERROR] = {NULL, NULL, P_NONE};
-    rules[T_EOF] = {NULL, NULL, P_NONE};
+struct ParseRuleTable
+{
+    ParseRule rules[T_EOF + 1] = {};
+
+    constexpr ParseRuleTable()
+    {
+        rules[T_LPAREN] = {&Compiler::grouping, &Compiler::call, P_CALL};
+        rules[T_RPAREN] = {NULL, NULL, P_NONE};
+        rules[T_LBRACE] = {NULL, NULL, P_NONE};
+        rules[T_RBRACE] = {NULL, NULL, P_NONE};
+        rules[T_COMMA] = {NULL, NULL, P_NONE};
+        rules[T_DOT] = {NULL, NULL, P_NONE};
+        rules[T_MINUS] = {&Compiler::unary, &Compiler::binary, P_TERM};
+        rules[T_PLUS] = {NULL, &Compiler::binary, P_TERM};
+        rules[T_SEMICOLON] = {NULL, NULL, P_NONE};
+        rules[T_SLASH] = {NULL, &Compiler::binary, P_FACTOR};
+        rules[T_STAR] = {NULL, &Compiler::binary, P_FACTOR};
+        rules[T_NOT] = {&Compiler::unary, NULL, P_NONE};
+        rules[T_DNOTE] = {NULL, &Compiler::binary, P_EQUALITY};
+        rules[T_EQ] = {NULL, NULL, P_NONE};
+        rules[T_EQUIV] = {NULL, &Compiler::binary, P_EQUALITY};
+        rules[T_GRT] = {NULL, &Compiler::binary, P_COMPARISON};
+        rules[T_GRTEQ] = {NULL, &Compiler::binary, P_COMPARISON};
+        rules[T_LSS] = {NULL, &Compiler::binary, P_COMPARISON};
+        rules[T_LSSEQ] = {NULL, &Compiler::binary, P_COMPARISON};
+        rules[T_ID] = {&Compiler::variable, NULL, P_NONE};
+        rules[T_STR] = {&Compiler::string, NULL, P_NONE};
+        rules[T_NUM] = {&Compiler::number, NULL, P_NONE};
+        rules[T_AND] = {NULL, &Compiler::and_, P_AND};
+        rules[T_CLASS] = {NULL, NULL, P_NONE};
+        rules[T_ELSE] = {NULL, NULL, P_NONE};
+        rules[T_FALSE] = {&Compiler::literal, NULL, P_NONE};
+        rules[T_FOR] = {NULL, NULL, P_NONE};
+        rules[T_FUN] = {NULL, NULL, P_NONE};
+        rules[T_IF] = {NULL, NULL, P_NONE};
+        rules[T_NIL] = {&Compiler::literal, NULL, P_NONE};
+        rules[T_OR] = {NULL, &Compiler::or_, P_OR};
+        rules[T_PRINT] = {NULL, NULL, P_NONE};
+        rules[T_RETURN] = {NULL, NULL, P_NONE};
+        rules[T_SUPER] = {NULL, NULL, P_NONE};
+        rules[T_THIS] = {NULL, NULL, P_NONE};
+        rules[T_TRUE] = {&Compiler::literal, NULL, P_NONE};
+        rules[T_VAR] = {NULL, NULL, P_NONE};
+        rules[T_WHILE] = {NULL, NULL, P_NONE};
+        rules[T_ERROR] = {NULL, NULL, P_NONE};
+        rules[T_EOF] = {NULL, NULL, P_NONE};
+    }
+};
+
+static constexpr ParseRuleTable parseRules;
+
+Parser::Parser(const char *source) : lexer(source)
+{
+    // the thread only pays off once there is enough to lex and a second core to lex it on, otherwise the two sides
+    // just take turns waiting for each other; small sources are lexed as they are parsed and never ask for the cores
+    if (strnlen(source, STREAM_MIN_SOURCE) < STREAM_MIN_SOURCE)
+        return;
+
+    static const bool multicore = std::thread::hardware_concurrency() > 1;
+    if (multicore)
+        stream = std::make_unique<TokenStream>(source);
 }
 
 /**
@@ -148,7 +161,7 @@ void Parser::advance()
 
     for (;;)
     {
-        current = lexer.scanToken();
+        current = stream ? stream->next() : lexer.scanToken();
         if (current.type != T_ERROR)
             break;
         errorAtCurrent(current.start);
@@ -206,14 +219,14 @@ bool Parser::match(TokenType type)
 
 /**
 
-    Function to get the parse rule for a given token type from the 'rules' map of the parser.
+    Function to get the parse rule for a given token type from the constant rule table.
     @param type: The token type for which the parse rule is to be obtained.
-    @return ParseRule*: A pointer to the parse rule for the given token type.
+    @return const ParseRule*: A pointer to the parse rule for the given token type.
     */
 
-ParseRule *Compiler::getRule(TokenType type)
+const ParseRule *Compiler::getRule(TokenType type)
 {
-    return &parser.rules[type];
+    return &parseRules.rules[type];
 }
 
 /**
@@ -266,8 +279,18 @@ void Compiler::emitBytes(uint8_t byte1, uint8_t byte2)
     emitByte(byte2);
 }
 
+// instruction followed by a big endian two byte operand
+void Compiler::emitShortOperand(uint8_t instruction, uint16_t operand)
+{
+    emitByte(instruction);
+    emitByte((operand >> 8) & 0xff);
+    emitByte(operand & 0xff);
+}
+
 void Compiler::emitLoop(int loopStart)
 {
+    // a constant just before a jump is not the value of what follows it, see patchJump()
+    current->lastConstant = ConstantExpression();
     emitByte(OP_LOOP);
 
     int offset = currentChunk()->bytes.size() - loopStart + 2;
@@ -280,19 +303,46 @@ void Compiler::emitLoop(int loopStart)
 
 int Compiler::emitJump(uint8_t instruction)
 {
+    current->lastConstant = ConstantExpression();
     emitByte(instruction);
     emitByte(0xff);
     emitByte(0xff);
     return currentChunk()->bytes.size() - 2;
 }
 
+// implicit return at the end of a function body
 void Compiler::emitReturn()
 {
-    emitByte(OP_RETURN);
+    emitBytes(OP_NIL, OP_RETURN);
+}
+
+// Numbers are only the same constant if their bits match so 0 and -0 keep separate slots
+static bool identicalValues(VM &vm, Value a, Value b)
+{
+    if (IS_NUMBER(a) && IS_NUMBER(b))
+    {
+        double x = AS_NUMBER(a), y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    return valuesEqual(vm, a, b);
+}
+
+static bool isFalsey(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+// Reuses an existing slot of the constant pool when the same value was already added, strings are interned so
+// duplicate literals land on the same slot too
 uint8_t Compiler::makeConstant(Value value)
 {
+    std::vector<Value> &pool = currentChunk()->constants.values;
+    for (int i = 0; i < (int)pool.size(); i++)
+    {
+        if (identicalValues(*vm, pool[i], value))
+            return uint8_t(i);
+    }
+
     int constant = currentChunk()->addConstant(value);
     if (constant > UINT8_MAX)
     {
@@ -305,7 +355,122 @@ uint8_t Compiler::makeConstant(Value value)
 
 void Compiler::emitConstant(Value value)
 {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    int poolSize = currentChunk()->constants.size();
+    int start = currentChunk()->bytes.size();
+    uint8_t index = makeConstant(value);
+    emitBytes(OP_CONSTANT, index);
+
+    current->lastConstant.start = start;
+    current->lastConstant.end = currentChunk()->bytes.size();
+    current->lastConstant.index = index;
+    current->lastConstant.fresh = currentChunk()->constants.size() > poolSize;
+    current->lastConstant.value = value;
+}
+
+// Emits the cheapest instruction that pushes value
+void Compiler::emitValue(Value value)
+{
+    if (!IS_NIL(value) && !IS_BOOL(value))
+    {
+        emitConstant(value);
+        return;
+    }
+
+    int start = currentChunk()->bytes.size();
+    emitByte(IS_NIL(value) ? OP_NIL : AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+
+    current->lastConstant.start = start;
+    current->lastConstant.end = currentChunk()->bytes.size();
+    current->lastConstant.index = -1;
+    current->lastConstant.fresh = false;
+    current->lastConstant.value = value;
+}
+
+// True if the last thing emitted into the chunk was a lone constant, which is then copied into constant
+bool Compiler::endsWithConstant(ConstantExpression &constant)
+{
+    if (current->lastConstant.end == -1 || current->lastConstant.end != (int)currentChunk()->bytes.size())
+        return false;
+
+    constant = current->lastConstant;
+    return true;
+}
+
+/*
+Replaces the instructions of one constant operand (unary) or two adjacent ones (binary) with a single instruction
+pushing result. Pool slots that were added only for those operands are given back when they are still the last ones
+in the pool, nothing emitted after them can be referring to them.
+*/
+void Compiler::foldConstants(ConstantExpression &first, ConstantExpression *second, Value result)
+{
+    std::shared_ptr<ByteArray> chunk = currentChunk();
+    std::vector<Value> &pool = chunk->constants.values;
+
+    if (second != nullptr && second->fresh && second->index == (int)pool.size() - 1)
+        pool.pop_back();
+    if (first.fresh && first.index == (int)pool.size() - 1)
+        pool.pop_back();
+
+    chunk->bytes.resize(first.start);
+    chunk->lines.resize(first.start);
+
+    emitValue(result);
+}
+
+// Evaluates a binary operator on two constants exactly the way the VM would, returns false for anything that has to
+// be left to the VM (i.e. it would be a runtime error)
+bool Compiler::foldBinary(TokenType operatorType, Value a, Value b, Value &result)
+{
+    if (operatorType == T_EQUIV || operatorType == T_DNOTE)
+    {
+        bool equal = valuesEqual(*vm, a, b);
+        result = BOOL_VAL(operatorType == T_EQUIV ? equal : !equal);
+        return true;
+    }
+
+    if (operatorType == T_PLUS && IS_STRING(a) && IS_STRING(b))
+    {
+        std::string joined(AS_STRING(a)->chars, AS_STRING(a)->length);
+        joined.append(AS_STRING(b)->chars, AS_STRING(b)->length);
+        result = OBJ_VAL(makeString(*vm, joined.data(), joined.size()));
+        return true;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))
+        return false;
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+
+    switch (operatorType)
+    {
+    case T_PLUS:
+        result = ARITHMETIC_VAL(x + y);
+        return true;
+    case T_MINUS:
+        result = ARITHMETIC_VAL(x - y);
+        return true;
+    case T_STAR:
+        result = ARITHMETIC_VAL(x * y);
+        return true;
+    case T_SLASH:
+        result = ARITHMETIC_VAL(x / y);
+        return true;
+    case T_GRT:
+        result = BOOL_VAL(x > y);
+        return true;
+    case T_GRTEQ:
+        result = BOOL_VAL(!(x < y));
+        return true;
+    case T_LSS:
+        result = BOOL_VAL(x < y);
+        return true;
+    case T_LSSEQ:
+        result = BOOL_VAL(!(x > y));
+        return true;
+    default:
+        return false;
+    }
 }
 
 void Compiler::patchJump(int offset)
@@ -319,26 +484,83 @@ void Compiler::patchJump(int offset)
 
     currentChunk()->bytes[offset] = (jump >> 8) & 0xff;
     currentChunk()->bytes[offset + 1] = jump & 0xff;
+
+    // code ending here is also reached by the jump, so whatever constant was emitted last is only one of the values
+    // the expression can have, i.e. the 1 of 'false and 1', and must not be folded with what comes next
+    current->lastConstant = ConstantExpression();
+}
+
+/*
+Starts compiling a new function inside the current one. The ObjFunction is only allocated once the scope is linked in
+with a NULL function, so a collection triggered by the allocation still sees every enclosing function.
+*/
+void Compiler::beginFunction(FunctionScope *scope, FunctionType type)
+{
+    scope->enclosing = current;
+    scope->function = NULL;
+    scope->type = type;
+    scope->localCount = 0;
+    scope->scopeDepth = 0;
+    scope->lastConstant = ConstantExpression();
+    current = scope;
+
+    scope->function = newFunction(*vm);
+    if (type != TYPE_SCRIPT)
+        scope->function->name = makeString(*vm, parser.previous.start, parser.previous.length);
+
+    // slot 0 belongs to the function being called, its empty name can never be resolved
+    Local *local = &scope->locals[scope->localCount++];
+    local->depth = 0;
+    local->name.start = "";
+    local->name.length = 0;
 }
 
-void Compiler::endCompiler()
+// Finishes the innermost function: its code is optimized once it is complete and its stack use is measured
+ObjFunction *Compiler::endFunction()
 {
     emitReturn();
-#ifdef DEBUG_PRINT_CODE
+    ObjFunction *function = current->function;
+
     if (!parser.hadError)
     {
-        Disassembler debug = Disassembler(currentChunk(), "Code");
-        debug.disassembleByteArray();
-    }
+        const char *name = function->name != NULL ? function->name->chars : "<script>";
+        if (printCode)
+            Disassembler(function->chunk, name).disassembleByteArray();
+
+#ifdef OPTIMIZE_BYTECODE
+        Optimizer(function->chunk).optimize();
+        if (printCode)
+        {
+            std::string title = std::string(name) + " (optimized)";
+            Disassembler(function->chunk, title.c_str()).disassembleByteArray();
+        }
 #endif
+    }
+
+    function->maxStack = function->chunk->maxStackDepth(function->arity + 1);
+    current = current->enclosing;
+    return function;
 }
 
 void Compiler::binary(bool canAssign)
 {
     TokenType operatorType = parser.previous.type;
-    ParseRule *rule = Compiler::getRule(operatorType);
+    const ParseRule *rule = getRule(operatorType);
+
+    ConstantExpression left, right;
+    bool leftConstant = endsWithConstant(left);
+
     parser.parsePrecedence((Precedence)(rule->precedence + 1), this);
 
+    // both operands are constants sitting right next to each other -> evaluate now instead of on every execution
+    Value result;
+    if (leftConstant && endsWithConstant(right) && right.start == left.end &&
+        foldBinary(operatorType, left.value, right.value, result))
+    {
+        foldConstants(left, &right, result);
+        return;
+    }
+
     switch (operatorType)
     {
     // !=, >=, <= output two bytes -> one that is the opposite of the operation (=, <, >) and a negation to flip it
@@ -382,13 +604,13 @@ void Compiler::literal(bool canAssign)
     switch (parser.previous.type)
     {
     case T_FALSE:
-        emitByte(OP_FALSE);
+        emitValue(BOOL_VAL(false));
         break;
     case T_NIL:
-        emitByte(OP_NIL);
+        emitValue(NIL_VAL);
         break;
     case T_TRUE:
-        emitByte(OP_TRUE);
+        emitValue(BOOL_VAL(true));
         break;
     default:
         return;
@@ -412,7 +634,7 @@ void Compiler::number(bool canAssign)
 void Compiler::string(bool canAssign)
 {
     // +1 and -2 trim the leading and ending qoutation marks
-    emitConstant(OBJ_VAL(makeString(parser.previous.start + 1, parser.previous.length - 2)));
+    emitConstant(OBJ_VAL(makeString(*vm, parser.previous.start + 1, parser.previous.length - 2)));
 }
 
 static bool identifiersEqual(Token* a, Token* b) {
@@ -422,9 +644,9 @@ static bool identifiersEqual(Token* a, Token* b) {
 
 int Compiler::resolveLocal(Token &name)
 {
-    for (int i = localCount - 1; i >= 0; i--)
+    for (int i = current->localCount - 1; i >= 0; i--)
     {
-        Local* local = &locals[i];
+        Local* local = &current->locals[i];
         if (identifiersEqual(&local->name, &name))
         {
             if (local->depth == -1)
@@ -449,18 +671,23 @@ void Compiler::namedVariable(Token name, bool canAssign)
     }
     else
     {
-        arg = identifierConstant(name);
+        arg = identifierSlot(name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
 
+    uint8_t op = getOp;
     if (canAssign && parser.match(T_EQ))
     {
         expression();
-        emitBytes(setOp, (uint8_t)arg);
+        op = setOp;
     }
+
+    // locals are addressed by a one byte stack slot, globals by a two byte index into the VM's global slots
+    if (op == OP_GET_LOCAL || op == OP_SET_LOCAL)
+        emitBytes(op, (uint8_t)arg);
     else
-        emitBytes(getOp, (uint8_t)arg);
+        emitShortOperand(op, (uint16_t)arg);
 }
 
 void Compiler::variable(bool canAssign)
@@ -476,6 +703,21 @@ void Compiler::unary(bool canAssign)
     // compile operand
     parser.parsePrecedence(P_UNARY, this);
 
+    ConstantExpression operand;
+    if (endsWithConstant(operand))
+    {
+        if (operatorType == T_NOT)
+        {
+            foldConstants(operand, nullptr, BOOL_VAL(isFalsey(operand.value)));
+            return;
+        }
+        if (operatorType == T_MINUS && IS_NUMBER(operand.value))
+        {
+            foldConstants(operand, nullptr, NUMBER_VAL(-AS_NUMBER(operand.value)));
+            return;
+        }
+    }
+
     switch (operatorType)
     {
     case T_NOT:
@@ -489,66 +731,105 @@ void Compiler::unary(bool canAssign)
     }
 }
 
-// returns index of variable name as a string in chunk -> a string name is too big for
-// byte code stream which is why we access using the index of type uint8_t
-uint8_t Compiler::identifierConstant(Token name)
+uint8_t Compiler::argumentList()
 {
-    return makeConstant(OBJ_VAL(makeString(name.start, name.length)));
+    uint8_t argCount = 0;
+    if (!parser.check(T_RPAREN))
+    {
+        do
+        {
+            expression();
+            if (argCount == 255)
+                parser.error("Can't have more than 255 arguments.");
+            argCount++;
+        } while (parser.match(T_COMMA));
+    }
+
+    parser.consume(T_RPAREN, "Expect ')' after arguments.");
+    return argCount;
+}
+
+// The callee is already on the stack, the arguments go on top of it
+void Compiler::call(bool canAssign)
+{
+    uint8_t argCount = argumentList();
+    emitBytes(OP_CALL, argCount);
+}
+
+// returns the VM's global slot for a variable name -> globals are resolved to an index at compile time so the
+// VM reads them with an array load instead of hashing the name on every access
+uint16_t Compiler::identifierSlot(Token name)
+{
+    int slot = vm->globalSlot(makeString(*vm, name.start, name.length));
+    if (slot > UINT16_MAX)
+    {
+        parser.error("Too many global variables.");
+        return 0;
+    }
+
+    return uint16_t(slot);
 }
 
 void Compiler::declareVariable()
 {
     // because globals are late bound simply return if not in scope
-    if (scopeDepth == 0)
+    if (current->scopeDepth == 0)
         return;
 
     Token &name = parser.previous;
 
-    for (int i = localCount - 1; i >= 0; i--)
+    for (int i = current->localCount - 1; i >= 0; i--)
     {
-        Local *local = &locals[i];
-        if (local->depth != -1 && local->depth < scopeDepth)
+        Local *local = &current->locals[i];
+        if (local->depth != -1 && local->depth < current->scopeDepth)
         {
             break;
         }
 
-        if (std::string(name.start) == std::string(local->name.start))
+        if (identifiersEqual(&name, &local->name))
         {
             parser.error("Already a variable with this name in this scope.");
         }
     }
 
-    if (localCount == UINT8_COUNT)
+    if (current->localCount == UINT8_COUNT)
     {
         parser.error("Too many local variables in function.");
         return;
     }
 
-    Local *local = &locals[localCount++];
+    Local *local = &current->locals[current->localCount++];
     local->depth = -1;
     local->name = name;
 }
 
-uint8_t Compiler::parseVariable(const char *errorMessage)
+uint16_t Compiler::parseVariable(const char *errorMessage)
 {
     parser.consume(T_ID, errorMessage);
 
     declareVariable();
-    if (scopeDepth > 0)
+    if (current->scopeDepth > 0)
         return 0;
 
-    return identifierConstant(parser.previous);
+    return identifierSlot(parser.previous);
+}
+
+void Compiler::markInitialized()
+{
+    if (current->scopeDepth == 0)
+        return;
+    current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
-void Compiler::defineVariable(uint8_t global)
+void Compiler::defineVariable(uint16_t global)
 {
-    if (scopeDepth > 0)
+    if (current->scopeDepth > 0)
     {
-        locals[localCount - 1].depth = scopeDepth;
+        markInitialized();
         return;
     }
 
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitShortOperand(OP_DEFINE_GLOBAL, global);
 }
 
 // when this is called for expr A and B, A is on top of the stack, so if A is false we skip the rest of
@@ -577,13 +858,13 @@ void Compiler::or_(bool canAssign)
 
 void Compiler::exitScope()
 {
-    scopeDepth--;
+    current->scopeDepth--;
 
     // remove locals declared in scope
-    while (localCount > 0 && locals[localCount - 1].depth > scopeDepth)
+    while (current->localCount > 0 && current->locals[current->localCount - 1].depth > current->scopeDepth)
     {
         emitByte(OP_POP);
-        localCount--;
+        current->localCount--;
     }
 }
 
@@ -603,9 +884,47 @@ void Compiler::block()
     parser.consume(T_RBRACE, "Expected '}' after block.");
 }
 
+// Compiles a function's parameters and body into a new ObjFunction and emits the constant that pushes it
+void Compiler::function(FunctionType type)
+{
+    FunctionScope scope;
+    beginFunction(&scope, type);
+    current->scopeDepth++;
+
+    parser.consume(T_LPAREN, "Expect '(' after function name.");
+    if (!parser.check(T_RPAREN))
+    {
+        do
+        {
+            current->function->arity++;
+            if (current->function->arity > 255)
+                parser.errorAtCurrent("Can't have more than 255 parameters.");
+
+            uint16_t parameter = parseVariable("Expect parameter name.");
+            defineVariable(parameter);
+        } while (parser.match(T_COMMA));
+    }
+    parser.consume(T_RPAREN, "Expect ')' after parameters.");
+    parser.consume(T_LBRACE, "Expect '{' before function body.");
+    block();
+
+    // the whole frame is discarded on return, so there is no need to pop the locals one by one
+    ObjFunction *function = endFunction();
+    emitConstant(OBJ_VAL(function));
+}
+
+void Compiler::funDeclaration()
+{
+    uint16_t global = parseVariable("Expect function name.");
+    // a function can refer to itself (recursion) so it is usable before its body is compiled
+    markInitialized();
+    function(TYPE_FUNCTION);
+    defineVariable(global);
+}
+
 void Compiler::varDeclaration()
 {
-    uint8_t global = parseVariable("Expect variable name.");
+    uint16_t global = parseVariable("Expect variable name.");
 
     // if there is assignment var gets that expression result, else the var value is init to nil
     if (parser.match(T_EQ))
@@ -627,7 +946,7 @@ void Compiler::expressionStatement()
 
 void Compiler::forStatement()
 {
-    scopeDepth++;
+    current->scopeDepth++;
 
     parser.consume(T_LPAREN, "Expected '(' after 'for'.");
 
@@ -728,6 +1047,22 @@ void Compiler::printStatement()
     emitByte(OP_PRINT);
 }
 
+void Compiler::returnStatement()
+{
+    if (current->type == TYPE_SCRIPT)
+        parser.error("Can't return from top-level code.");
+
+    if (parser.match(T_SEMICOLON))
+    {
+        emitReturn();
+        return;
+    }
+
+    expression();
+    parser.consume(T_SEMICOLON, "Expect ';' after return value.");
+    emitByte(OP_RETURN);
+}
+
 void Compiler::synchronize()
 {
     parser.panicMode = false;
@@ -758,7 +1093,11 @@ void Compiler::synchronize()
 
 void Compiler::declaration()
 {
-    if (parser.match(T_VAR))
+    if (parser.match(T_FUN))
+    {
+        funDeclaration();
+    }
+    else if (parser.match(T_VAR))
     {
         varDeclaration();
     }
@@ -789,6 +1128,11 @@ void Compiler::statement()
         ifStatement();
     }
 
+    else if (parser.match(T_RETURN))
+    {
+        returnStatement();
+    }
+
     else if (parser.match(T_WHILE))
     {
         whileStatement();
@@ -796,7 +1140,7 @@ void Compiler::statement()
 
     else if (parser.match(T_LBRACE))
     {
-        scopeDepth++;
+        current->scopeDepth++;
         block();
         exitScope();
     }
@@ -806,10 +1150,11 @@ void Compiler::statement()
     }
 }
 
-bool Compiler::compile(std::shared_ptr<ByteArray> bytearray)
+// Compiles the whole source as the body of an unnamed function, returns NULL if there was a compile error
+ObjFunction *Compiler::compile()
 {
-
-    compilingChunk = bytearray;
+    FunctionScope script;
+    beginFunction(&script, TYPE_SCRIPT);
 
     parser.hadError = false;
     parser.panicMode = false;
@@ -819,6 +1164,7 @@ bool Compiler::compile(std::shared_ptr<ByteArray> bytearray)
     {
         declaration();
     }
-    endCompiler();
-    return !parser.hadError;
+
+    ObjFunction *function = endFunction();
+    return parser.hadError ? NULL : function;
 }
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include "bytearray.hh"
 #include "common.hh"
 
+class VM;
+class ObjFunction;
+
 class Compiler;
 
 typedef void (Compiler::*ParseFn)(bool canAssign);
@@ -38,14 +41,10 @@ public:
     ParseFn infix;
     Precedence precedence;
 
-    ParseRule(){}
+    constexpr ParseRule() : prefix(nullptr), infix(nullptr), precedence(P_NONE) {}
 
-    ParseRule(ParseFn prefix, ParseFn infix, Precedence precedence)
-    {
-        this->prefix = prefix;
-        this->infix = infix;
-        this->precedence = precedence;
-    };
+    constexpr ParseRule(ParseFn prefix, ParseFn infix, Precedence precedence)
+        : prefix(prefix), infix(infix), precedence(precedence) {}
 };
 
 
@@ -53,8 +52,7 @@ public:
 /**
 
     @brief This class encapsulates utility necessary for SIMPL's recursive descent parser. The Parser object contains a Lexer
-    object to read in tokens from source code, an array of ParseRule objects that describe how to parse different operators
-    and tokens in the grammar, and several functions for parsing different types of statements and expressions. Despite the name, the
+    object to read in tokens from source code and several functions for parsing different types of statements and expressions. Despite the name, the
     compiler is generally responsible for performing the actually recursive descent.
 */
 
@@ -64,19 +62,11 @@ public:
     Token current;
     Token previous;
     Lexer lexer;
-    ParseRule rules[49];
-    bool hadError;
-    bool panicMode;
-
-    Parser() {}
-
-    Parser(const char *source)
-    {
-        lexer = Lexer(source);
-        generateRules();
-    }
+    std::unique_ptr<TokenStream> stream; // set for large sources when there is a core to spare, lexer is unused then
+    bool hadError = false;
+    bool panicMode = false;
 
-    void generateRules();
+    Parser(const char *source);
 
     void errorAt(Token token, const char *message);
 
@@ -111,24 +101,53 @@ struct Local
     Token name;
 };
 
+// Where the most recently emitted expression lives if it was nothing but a constant, used for constant folding
+struct ConstantExpression
+{
+    int start = -1;    // first byte of its instruction
+    int end = -1;      // one past its last byte
+    int index = -1;    // slot in the constant pool, -1 for nil/true/false
+    bool fresh = false; // whether that slot was added to the pool for this expression
+    Value value;
+};
+
+enum FunctionType
+{
+    TYPE_FUNCTION,
+    TYPE_SCRIPT
+};
+
+/**
+
+    @brief The state the Compiler keeps for each function it is in the middle of compiling. A function declaration
+    nested in another one pushes a new FunctionScope and pops it again once its body is compiled, the enclosing chain
+    is also how the garbage collector finds the functions that are still being compiled.
+    */
+struct FunctionScope
+{
+    FunctionScope *enclosing;
+    ObjFunction *function;
+    FunctionType type;
+
+    // keeps track of information for local/scoped variables during compilation, slot 0 holds the function itself
+    Local locals[UINT8_COUNT];
+    int localCount;
+    int scopeDepth;
+
+    ConstantExpression lastConstant;
+};
+
 class Compiler
 {
 public:
 
+    VM *vm; // owns the heap, intern table and global slots this compiler allocates into
     Parser parser;
-    std::shared_ptr<ByteArray> compilingChunk;
+    FunctionScope *current = nullptr; // innermost function being compiled
 
-    // keeps track of information for local/scoped variables during compilation
-    Local locals[UINT8_COUNT];
-    int localCount = 0;
-    int scopeDepth = 0;
-
-    Compiler(){}
+    bool printCode = false; // disassemble the chunk once it is compiled (--dump-bytecode)
 
-    Compiler(const char *source)
-    {
-        parser = Parser(source);
-    }
+    Compiler(VM *vm, const char *source) : vm(vm), parser(source) {}
 
     std::shared_ptr<ByteArray> currentChunk();
 
@@ -138,17 +157,29 @@ public:
 
     void emitBytes(uint8_t byte1, uint8_t byte2);
 
+    void emitShortOperand(uint8_t instruction, uint16_t operand);
+
     void emitLoop(int loopStart);
 
     void emitReturn();
 
+    void beginFunction(FunctionScope *scope, FunctionType type);
+
+    ObjFunction *endFunction();
+
     uint8_t makeConstant(Value value);
 
     void emitConstant(Value value);
 
-    void patchJump(int offset);
+    void emitValue(Value value);
+
+    bool endsWithConstant(ConstantExpression &constant);
+
+    void foldConstants(ConstantExpression &first, ConstantExpression *second, Value result);
 
-    void endCompiler();
+    bool foldBinary(TokenType operatorType, Value a, Value b, Value &result);
+
+    void patchJump(int offset);
 
     void binary(bool canAssign);
 
@@ -168,19 +199,25 @@ public:
 
     void unary(bool canAssign);
 
-    uint8_t identifierConstant(Token name);
+    uint8_t argumentList();
+
+    void call(bool canAssign);
+
+    uint16_t identifierSlot(Token name);
 
     void declareVariable();
 
-    uint8_t parseVariable(const char *errorMessage);
+    uint16_t parseVariable(const char *errorMessage);
 
-    void defineVariable(uint8_t global);
+    void markInitialized();
+
+    void defineVariable(uint16_t global);
 
     void and_(bool canAssign);
 
     void or_(bool canAssign);
 
-    ParseRule *getRule(TokenType type);
+    static const ParseRule *getRule(TokenType type);
 
     void exitScope();
 
@@ -188,6 +225,10 @@ public:
 
     void block();
 
+    void function(FunctionType type);
+
+    void funDeclaration();
+
     void varDeclaration();
 
     void expressionStatement();
@@ -196,6 +237,8 @@ public:
 
     void printStatement();
 
+    void returnStatement();
+
     void whileStatement();
 
     void forStatement();
@@ -206,7 +249,7 @@ public:
 
     void statement();
 
-    bool compile(std::shared_ptr<ByteArray> bytearray);
+    ObjFunction *compile();
 };
 
 #endif
\ No newline at end of file
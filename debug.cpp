@@ -41,6 +41,14 @@ int Disassembler::byteInstruction(const char *name, int offset)
     return offset + 2;
 }
 
+int Disassembler::shortInstruction(const char *name, int offset)
+{
+    uint16_t operand = (uint16_t)(bytearray->bytes.at(offset + 1) << 8);
+    operand |= bytearray->bytes.at(offset + 2);
+    printf("%-16s %4d\n", name, operand);
+    return offset + 3;
+}
+
 int Disassembler::jumpInstruction(const char *name, int sign, int offset)
 {
     uint16_t jump = (uint16_t)(bytearray->bytes.at(offset + 1) << 8);
@@ -49,71 +57,168 @@ int Disassembler::jumpInstruction(const char *name, int sign, int offset)
     return offset + 3;
 }
 
-int Disassembler::disassembleInstruction(int offset)
-{
-    printf("%04d ", offset);
-    if (offset > 0 && bytearray->lines.at(offset) == bytearray->lines.at(offset - 1))
-    {
-        printf("    | ");
-    }
-    else
-    {
-        printf("%4d ", bytearray->lines.at(offset));
-    }
+/**
 
-    uint8_t instruction = bytearray->bytes.at(offset);
+    @brief Returns the name of an opcode as it is spelled in the OpCode enum.
+    @param instruction The opcode.
+    @return The name, NULL for a byte that is not an opcode.
+    */
+const char *opcodeName(uint8_t instruction)
+{
     switch (instruction)
     {
     case OP_CONSTANT:
-        return constantInstruction("OP_CONSTANT", offset);
+        return "OP_CONSTANT";
     case OP_NIL:
-        return simpleInstruction("OP_NIL", offset);
-    case OP_FALSE:
-        return simpleInstruction("OP_FALSE", offset);
+        return "OP_NIL";
     case OP_TRUE:
-        return simpleInstruction("OP_TRUE", offset);
+        return "OP_TRUE";
+    case OP_FALSE:
+        return "OP_FALSE";
     case OP_POP:
-        return simpleInstruction("OP_POP", offset);
+        return "OP_POP";
+    case OP_DEFINE_GLOBAL:
+        return "OP_DEFINE_GLOBAL";
     case OP_GET_LOCAL:
-        return byteInstruction("OP_GET_LOCAL", offset);
+        return "OP_GET_LOCAL";
     case OP_SET_LOCAL:
-        return byteInstruction("OP_SET_LOCAL", offset);
-    case OP_DEFINE_GLOBAL:
-        return constantInstruction("OP_DEFINE_GLOBAL", offset);
+        return "OP_SET_LOCAL";
     case OP_GET_GLOBAL:
-        return constantInstruction("OP_GET_GLOBAL", offset);
+        return "OP_GET_GLOBAL";
     case OP_SET_GLOBAL:
-        return constantInstruction("OP_SET_GLOBAL", offset);
+        return "OP_SET_GLOBAL";
     case OP_EQUAL:
-        return simpleInstruction("OP_EQUAL", offset);
+        return "OP_EQUAL";
     case OP_GREATER:
-        return simpleInstruction("OP_GREATER", offset);
+        return "OP_GREATER";
     case OP_LESS:
-        return simpleInstruction("OP_LESS", offset);
+        return "OP_LESS";
+    case OP_NOT_EQUAL:
+        return "OP_NOT_EQUAL";
+    case OP_GREATER_EQUAL:
+        return "OP_GREATER_EQUAL";
+    case OP_LESS_EQUAL:
+        return "OP_LESS_EQUAL";
     case OP_ADD:
-        return simpleInstruction("OP_ADD", offset);
+        return "OP_ADD";
     case OP_SUBTRACT:
-        return simpleInstruction("OP_SUBTRACT", offset);
+        return "OP_SUBTRACT";
     case OP_MULTIPLY:
-        return simpleInstruction("OP_MULTIPLY", offset);
+        return "OP_MULTIPLY";
     case OP_DIVIDE:
-        return simpleInstruction("OP_DIVIDE", offset);
+        return "OP_DIVIDE";
     case OP_NOT:
-        return simpleInstruction("OP_NOT", offset);
+        return "OP_NOT";
     case OP_NEGATE:
-        return simpleInstruction("OP_NEGATE", offset);
+        return "OP_NEGATE";
+    case OP_CALL:
+        return "OP_CALL";
+    case OP_RETURN:
+        return "OP_RETURN";
     case OP_PRINT:
-        return simpleInstruction("OP_PRINT", offset);
+        return "OP_PRINT";
     case OP_JUMP:
-        return jumpInstruction("OP_JUMP", 1, offset);
+        return "OP_JUMP";
     case OP_JUMP_IF_FALSE:
-        return jumpInstruction("OP_JUMP_IF_FALSE", 1, offset);
+        return "OP_JUMP_IF_FALSE";
+    case OP_POP_JUMP_IF_FALSE:
+        return "OP_POP_JUMP_IF_FALSE";
     case OP_LOOP:
-        return jumpInstruction("OP_LOOP", -1, offset);
-    case OP_RETURN:
-        return simpleInstruction("OP_RETURN", offset);
+        return "OP_LOOP";
+    case OP_GET_LOCAL_2:
+        return "OP_GET_LOCAL_2";
+    case OP_ADD_LOCAL_CONSTANT:
+        return "OP_ADD_LOCAL_CONSTANT";
+    case OP_LESS_LOCAL_CONSTANT_JUMP:
+        return "OP_LESS_LOCAL_CONSTANT_JUMP";
+    case OP_GREATER_LOCAL_CONSTANT_JUMP:
+        return "OP_GREATER_LOCAL_CONSTANT_JUMP";
+    case OP_ADD_NUM_NUM:
+        return "OP_ADD_NUM_NUM";
+    case OP_ADD_STR_STR:
+        return "OP_ADD_STR_STR";
+    case OP_ADD_GENERIC:
+        return "OP_ADD_GENERIC";
+    default:
+        return NULL;
+    }
+}
+
+int Disassembler::localPairInstruction(const char *name, int offset)
+{
+    uint8_t first = bytearray->bytes.at(offset + 1);
+    uint8_t second = bytearray->bytes.at(offset + 2);
+    printf("%-16s %4d %4d\n", name, first, second);
+    return offset + 3;
+}
+
+int Disassembler::localConstantInstruction(const char *name, int offset)
+{
+    uint8_t slot = bytearray->bytes.at(offset + 1);
+    uint8_t constant = bytearray->bytes.at(offset + 2);
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(bytearray->constants.values.at(constant));
+    printf("'\n");
+    return offset + 3;
+}
+
+int Disassembler::localConstantJumpInstruction(const char *name, int offset)
+{
+    uint8_t slot = bytearray->bytes.at(offset + 1);
+    uint8_t constant = bytearray->bytes.at(offset + 2);
+    uint16_t jump = (uint16_t)(bytearray->bytes.at(offset + 3) << 8);
+    jump |= bytearray->bytes.at(offset + 4);
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(bytearray->constants.values.at(constant));
+    printf("' %4d -> %d\n", offset, offset + 5 + jump);
+    return offset + 5;
+}
+
+int Disassembler::disassembleInstruction(int offset)
+{
+    printf("%04d ", offset);
+    if (offset > 0 && bytearray->lines.at(offset) == bytearray->lines.at(offset - 1))
+    {
+        printf("    | ");
+    }
+    else
+    {
+        printf("%4d ", bytearray->lines.at(offset));
+    }
+
+    uint8_t instruction = bytearray->bytes.at(offset);
+    const char *name = opcodeName(instruction);
+    switch (instruction)
+    {
+    case OP_CONSTANT:
+        return constantInstruction(name, offset);
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_CALL:
+        return byteInstruction(name, offset);
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+        return shortInstruction(name, offset);
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+        return jumpInstruction(name, 1, offset);
+    case OP_LOOP:
+        return jumpInstruction(name, -1, offset);
+    case OP_GET_LOCAL_2:
+        return localPairInstruction(name, offset);
+    case OP_ADD_LOCAL_CONSTANT:
+        return localConstantInstruction(name, offset);
+    case OP_LESS_LOCAL_CONSTANT_JUMP:
+    case OP_GREATER_LOCAL_CONSTANT_JUMP:
+        return localConstantJumpInstruction(name, offset);
     default:
-        printf("Unknown opcode %d\n", instruction);
-        return offset + 1;
+        if (name == NULL)
+        {
+            printf("Unknown opcode %d\n", instruction);
+            return offset + 1;
+        }
+        return simpleInstruction(name, offset);
     }
 }
\ No newline at end of file
@@ -28,9 +28,19 @@ public:
 
     int byteInstruction(const char* name, int offset);
 
+    int shortInstruction(const char* name, int offset);
+
     int jumpInstruction(const char* name, int sign, int offset);
 
+    int localPairInstruction(const char *name, int offset);
+
+    int localConstantInstruction(const char *name, int offset);
+
+    int localConstantJumpInstruction(const char *name, int offset);
+
     int disassembleInstruction(int offset);
 };
 
+const char *opcodeName(uint8_t instruction);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,977 @@
+#include "jit.hh"
+#include "bytecodes.hh"
+#include "object.hh"
+
+#ifdef JIT_COMPILER
+
+#include <sys/mman.h>
+
+//////////////////////////////////////////////////
+// Helpers called from native code
+//////////////////////////////////////////////////
+
+/*
+Native code keeps the stack top in a register and never updates the frame's ip, a helper brings both up to date
+before doing anything that might look at them, like STORE_FRAME in VM::execute(). instruction points at the opcode of
+the instruction being run, the frame's ip has to be past it.
+
+Every helper returns the new stack top, or NULL after a runtime error.
+*/
+static void storeFrame(VM *vm, Value *sp, const uint8_t *instruction)
+{
+    vm->frames[vm->frameCount - 1].ip = (uint8_t *)instruction + instructionSize(*instruction);
+    vm->stackTop = sp;
+}
+
+// Runs one instruction the way VM::execute() does, for the instructions without an inline template and the slow paths
+// of the ones with one
+static Value *jitInstruction(VM *vm, Value *sp, const uint8_t *instruction)
+{
+    storeFrame(vm, sp, instruction);
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    Value *constants = frame->function->chunk->constants.values.data();
+
+#define BINARY_OP(valueType, op)                                 \
+    do                                                           \
+    {                                                            \
+        if (!IS_NUMBER(sp[-1]) || !IS_NUMBER(sp[-2]))            \
+        {                                                        \
+            vm->runtimeError("Operands must be numbers.");       \
+            return NULL;                                         \
+        }                                                        \
+        sp[-2] = valueType(AS_NUMBER(sp[-2]) op AS_NUMBER(sp[-1])); \
+        return sp - 1;                                           \
+    } while (false)
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+#define READ_GLOBAL() (vm->globals[(uint16_t)(instruction[1] << 8 | instruction[2])])
+
+    switch (genericOpcode(*instruction))
+    {
+    case OP_DEFINE_GLOBAL:
+    {
+        Global &global = READ_GLOBAL();
+        global.value = sp[-1];
+        global.defined = true;
+        return sp - 1;
+    }
+    case OP_GET_GLOBAL:
+    {
+        Global &global = READ_GLOBAL();
+        if (!global.defined)
+        {
+            vm->runtimeError("Undefined variable '%s'.", global.name->chars);
+            return NULL;
+        }
+        *sp = global.value;
+        return sp + 1;
+    }
+    case OP_SET_GLOBAL:
+    {
+        Global &global = READ_GLOBAL();
+        if (!global.defined)
+        {
+            vm->runtimeError("Undefined variable '%s'", global.name->chars);
+            return NULL;
+        }
+        global.value = sp[-1];
+        return sp;
+    }
+    case OP_EQUAL:
+        sp[-2] = BOOL_VAL(valuesEqual(*vm, sp[-2], sp[-1]));
+        return sp - 1;
+    case OP_NOT_EQUAL:
+        sp[-2] = BOOL_VAL(!valuesEqual(*vm, sp[-2], sp[-1]));
+        return sp - 1;
+    case OP_GREATER:
+        BINARY_OP(BOOL_VAL, >);
+    case OP_LESS:
+        BINARY_OP(BOOL_VAL, <);
+    case OP_GREATER_EQUAL:
+        BINARY_OP(NOT_BOOL_VAL, <);
+    case OP_LESS_EQUAL:
+        BINARY_OP(NOT_BOOL_VAL, >);
+    case OP_SUBTRACT:
+        BINARY_OP(ARITHMETIC_VAL, -);
+    case OP_MULTIPLY:
+        BINARY_OP(ARITHMETIC_VAL, *);
+    case OP_DIVIDE:
+        BINARY_OP(ARITHMETIC_VAL, /);
+    case OP_ADD:
+        if (IS_STRING(sp[-1]) && IS_STRING(sp[-2]))
+        {
+            // the operands stay on the stack, and so reachable, until the result has been made
+            Value result = vm->concatenate(AS_STRING(sp[-2]), AS_STRING(sp[-1]));
+            sp[-2] = result;
+            return sp - 1;
+        }
+        if (IS_NUMBER(sp[-1]) && IS_NUMBER(sp[-2]))
+        {
+            sp[-2] = ARITHMETIC_VAL(AS_NUMBER(sp[-2]) + AS_NUMBER(sp[-1]));
+            return sp - 1;
+        }
+        vm->runtimeError("Operands must be two numbers or two strings.");
+        return NULL;
+    case OP_NOT:
+        sp[-1] = BOOL_VAL(vm->isFalsey(sp[-1]));
+        return sp;
+    case OP_NEGATE:
+        if (!IS_NUMBER(sp[-1]))
+        {
+            vm->runtimeError("Operand must be a number.");
+            return NULL;
+        }
+        sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1]));
+        return sp;
+    case OP_PRINT:
+        printValue(sp[-1]);
+        std::cout << '\n';
+        return sp - 1;
+    case OP_ADD_LOCAL_CONSTANT:
+    {
+        Value *local = &frame->slots[instruction[1]];
+        Value constant = constants[instruction[2]];
+        if (IS_NUMBER(*local) && IS_NUMBER(constant))
+            *local = ARITHMETIC_VAL(AS_NUMBER(*local) + AS_NUMBER(constant));
+        else if (IS_STRING(*local) && IS_STRING(constant))
+            *local = vm->concatenate(AS_STRING(*local), AS_STRING(constant));
+        else
+        {
+            vm->runtimeError("Operands must be two numbers or two strings.");
+            return NULL;
+        }
+        return sp;
+    }
+    case OP_LESS_LOCAL_CONSTANT_JUMP:
+    case OP_GREATER_LOCAL_CONSTANT_JUMP:
+        // the comparison itself is always inline, only its operands failing the number check get here
+        vm->runtimeError("Operands must be numbers.");
+        return NULL;
+    default:
+        return sp;
+    }
+
+#undef READ_GLOBAL
+#undef BINARY_OP
+#undef NOT_BOOL_VAL
+}
+
+// Pushes the callee's frame and runs it to its return, the result is left in place of the callee and its arguments
+static Value *jitCall(VM *vm, Value *sp, const uint8_t *instruction)
+{
+    storeFrame(vm, sp, instruction);
+    int argCount = instruction[1];
+    if (!vm->callValue(sp[-1 - argCount], argCount))
+        return NULL;
+    if (vm->runFrame() != INTERPRET_OK)
+        return NULL;
+    return vm->stackTop;
+}
+
+// OP_RETURN, pops the frame; the native code returns to whoever started it right after
+static void jitReturn(VM *vm, Value *sp)
+{
+    Value result = sp[-1];
+    vm->frameCount--;
+    vm->stackTop = vm->frames[vm->frameCount].slots;
+
+    // returning from the script itself also pops the script's function
+    if (vm->frameCount != 0)
+        *vm->stackTop++ = result;
+}
+
+//////////////////////////////////////////////////
+// Value layout
+//////////////////////////////////////////////////
+
+/*
+Where the templates find the parts of a Value. A number can be overwritten by another number by writing just its
+double, anything else is written as a whole, copied from a Value made in C++.
+*/
+struct ValueLayout
+{
+    int typeOffset = 0;   // of the ValueType, without NaN-boxing
+    int numberOffset = 0; // of the double
+    int boolOffset = 0;   // of the bool, without NaN-boxing
+
+    ValueLayout()
+    {
+#ifndef NAN_BOXING
+        Value number = NUMBER_VAL(0);
+        Value boolean = BOOL_VAL(false);
+        typeOffset = (int)((uint8_t *)&number.type - (uint8_t *)&number);
+        numberOffset = (int)((uint8_t *)&AS_NUMBER(number) - (uint8_t *)&number);
+        boolOffset = (int)((uint8_t *)&AS_BOOL(boolean) - (uint8_t *)&boolean);
+#endif
+    }
+};
+
+static const ValueLayout layout;
+
+static const int VALUE_SIZE = (int)sizeof(Value);
+static_assert(sizeof(Value) % 8 == 0, "Values are copied in 8 byte pieces");
+
+//////////////////////////////////////////////////
+// Assembler
+//////////////////////////////////////////////////
+
+enum Register
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+};
+
+// Condition codes of jcc
+enum Condition
+{
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6, // unsigned <=, also taken for an unordered ucomisd
+    CC_A = 0x7,  // unsigned >, not taken for an unordered ucomisd
+    CC_NP = 0xB, // parity clear, i.e. a ucomisd that was ordered
+};
+
+/*
+Registers the native code keeps its state in, all callee saved so they survive calls into helpers:
+- SP is the VM stack top, like sp in VM::execute()
+- SLOTS and CONSTANTS are the frame's locals and the function's constant pool
+- VMREG is the VM, the first argument of every helper
+*/
+#define SP RBX
+#define SLOTS R12
+#define CONSTANTS R13
+#define VMREG R14
+
+// Just enough of x86-64 for the templates: every memory operand is [base + disp32]
+class Assembler
+{
+public:
+    std::vector<uint8_t> code;
+
+    int position()
+    {
+        return code.size();
+    }
+
+    void byte(uint8_t value)
+    {
+        code.push_back(value);
+    }
+
+    void int32(int32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            byte((uint8_t)(value >> (8 * i)));
+    }
+
+    void int64(uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+            byte((uint8_t)(value >> (8 * i)));
+    }
+
+    void rex(bool wide, int reg, int base)
+    {
+        if (wide || reg >= 8 || base >= 8)
+            byte(0x40 | (wide << 3) | ((reg >> 3) << 2) | (base >> 3));
+    }
+
+    void memory(int reg, int base, int32_t disp)
+    {
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP)
+            byte(0x24); // RSP and R12 as a base need a SIB byte
+        int32(disp);
+    }
+
+    void direct(int reg, int rm)
+    {
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    void push(int reg)
+    {
+        rex(false, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(int reg)
+    {
+        rex(false, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+
+    // mov reg, [base + disp]
+    void load(int reg, int base, int32_t disp)
+    {
+        rex(true, reg, base);
+        byte(0x8B);
+        memory(reg, base, disp);
+    }
+
+    // mov [base + disp], reg
+    void store(int base, int32_t disp, int reg)
+    {
+        rex(true, reg, base);
+        byte(0x89);
+        memory(reg, base, disp);
+    }
+
+    // mov reg, imm64
+    void moveImmediate(int reg, uint64_t value)
+    {
+        rex(true, 0, reg);
+        byte(0xB8 + (reg & 7));
+        int64(value);
+    }
+
+    // mov dst, src
+    void move(int dst, int src)
+    {
+        rex(true, src, dst);
+        byte(0x89);
+        direct(src, dst);
+    }
+
+    // add reg, imm32
+    void add(int reg, int32_t value)
+    {
+        rex(true, 0, reg);
+        byte(0x81);
+        direct(0, reg);
+        int32(value);
+    }
+
+    // and dst, src
+    void andRegister(int dst, int src)
+    {
+        rex(true, src, dst);
+        byte(0x21);
+        direct(src, dst);
+    }
+
+    // cmp a, b
+    void compare(int a, int b)
+    {
+        rex(true, b, a);
+        byte(0x39);
+        direct(b, a);
+    }
+
+    // cmp dword [base + disp], imm32
+    void compare32(int base, int32_t disp, int32_t value)
+    {
+        rex(false, 0, base);
+        byte(0x81);
+        memory(7, base, disp);
+        int32(value);
+    }
+
+    // cmp byte [base + disp], imm8
+    void compare8(int base, int32_t disp, uint8_t value)
+    {
+        rex(false, 0, base);
+        byte(0x80);
+        memory(7, base, disp);
+        byte(value);
+    }
+
+    // test reg, reg
+    void test(int reg)
+    {
+        rex(true, reg, reg);
+        byte(0x85);
+        direct(reg, reg);
+    }
+
+    // btc reg, bit
+    void complementBit(int reg, uint8_t bit)
+    {
+        rex(true, 0, reg);
+        byte(0x0F);
+        byte(0xBA);
+        direct(7, reg);
+        byte(bit);
+    }
+
+    // Scalar double instruction (movsd, addsd, ...) between xmm and [base + disp]
+    void sse(uint8_t prefix, uint8_t opcode, int xmm, int base, int32_t disp)
+    {
+        byte(prefix);
+        rex(false, xmm, base);
+        byte(0x0F);
+        byte(opcode);
+        memory(xmm, base, disp);
+    }
+
+    // ucomisd a, b
+    void compareDoubles(int a, int b)
+    {
+        byte(0x66);
+        byte(0x0F);
+        byte(0x2E);
+        direct(a, b);
+    }
+
+    // jmp rel32, returns where the displacement goes for bind() / bindTo()
+    int jump()
+    {
+        byte(0xE9);
+        int32(0);
+        return position() - 4;
+    }
+
+    // jcc rel32
+    int jumpIf(Condition condition)
+    {
+        byte(0x0F);
+        byte(0x80 | condition);
+        int32(0);
+        return position() - 4;
+    }
+
+    void bindTo(int displacement, int target)
+    {
+        int32_t relative = target - (displacement + 4);
+        memcpy(&code[displacement], &relative, 4);
+    }
+
+    void bind(int displacement)
+    {
+        bindTo(displacement, position());
+    }
+
+    void bindAll(std::vector<int> &displacements)
+    {
+        for (int displacement : displacements)
+            bind(displacement);
+        displacements.clear();
+    }
+
+    // call through rax, so the helper can be anywhere in the address space
+    void call(const void *function)
+    {
+        moveImmediate(RAX, (uint64_t)(uintptr_t)function);
+        byte(0xFF);
+        direct(2, RAX);
+    }
+
+    // jmp reg
+    void jumpTo(int reg)
+    {
+        rex(false, 0, reg);
+        byte(0xFF);
+        direct(4, reg);
+    }
+
+    void ret()
+    {
+        byte(0xC3);
+    }
+
+    // mov eax, imm32
+    void moveResult(int32_t value)
+    {
+        byte(0xB8);
+        int32(value);
+    }
+};
+
+//////////////////////////////////////////////////
+// NativeCode
+//////////////////////////////////////////////////
+
+NativeCode::NativeCode(uint8_t *code, size_t size, std::vector<int> entries)
+{
+    this->code = code;
+    this->size = size;
+    this->entries = std::move(entries);
+}
+
+NativeCode::~NativeCode()
+{
+    munmap(code, size);
+}
+
+// Native code is entered with the VM, the stack top, the frame's slots and the machine code address to start at
+typedef InterpretResult (*NativeEntry)(VM *vm, Value *sp, Value *slots, const uint8_t *start);
+
+/**
+
+    Runs the frame on top of the VM, which has to be running this code, from the instruction at offset until the frame
+    returns.
+    @return INTERPRET_OK once the frame has returned, its result is then on top of the stack.
+    */
+InterpretResult NativeCode::run(VM &vm, int offset)
+{
+    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+    NativeEntry entry = (NativeEntry)(void *)code;
+    return entry(&vm, vm.stackTop, frame->slots, code + entries[offset]);
+}
+
+//////////////////////////////////////////////////
+// Compiler
+//////////////////////////////////////////////////
+
+JitCompiler::JitCompiler(ObjFunction *function)
+{
+    this->function = function;
+}
+
+// Writes a whole Value known at compile time to [base + disp]
+static void storeValue(Assembler &as, int base, int32_t disp, Value value)
+{
+    uint64_t pieces[sizeof(Value) / 8];
+    memcpy(pieces, &value, sizeof(Value));
+    for (int i = 0; i < VALUE_SIZE / 8; i++)
+    {
+        as.moveImmediate(RAX, pieces[i]);
+        as.store(base, disp + 8 * i, RAX);
+    }
+}
+
+static void copyValue(Assembler &as, int dstBase, int32_t dstDisp, int srcBase, int32_t srcDisp)
+{
+    for (int i = 0; i < VALUE_SIZE; i += 8)
+    {
+        as.load(RAX, srcBase, srcDisp + i);
+        as.store(dstBase, dstDisp + i, RAX);
+    }
+}
+
+// Jumps to one of failed unless the Value at [base + disp] is a number
+static void checkNumber(Assembler &as, int base, int32_t disp, std::vector<int> &failed)
+{
+#ifdef NAN_BOXING
+    as.load(RAX, base, disp);
+    as.moveImmediate(RCX, QNAN);
+    as.andRegister(RAX, RCX);
+    as.compare(RAX, RCX);
+    failed.push_back(as.jumpIf(CC_E));
+#else
+    as.compare32(base, disp + layout.typeOffset, VAL_NUMBER);
+    failed.push_back(as.jumpIf(CC_NE));
+#endif
+}
+
+// Replaces the arithmetic result in xmm0, already stored at [base + disp], by the canonical NaN if it is a NaN
+static void canonicalizeResult(Assembler &as, int base, int32_t disp)
+{
+    as.compareDoubles(0, 0);
+    int ordered = as.jumpIf(CC_NP);
+    as.moveImmediate(RAX, CANONICAL_NAN_BITS);
+    as.store(base, disp, RAX);
+    as.bind(ordered);
+}
+
+// Adds a jump to taken for when the Value at [base + disp] is falsey, see VM::isFalsey()
+static void jumpIfFalsey(Assembler &as, int base, int32_t disp, std::vector<int> &taken)
+{
+#ifdef NAN_BOXING
+    as.load(RAX, base, disp);
+    as.moveImmediate(RCX, NIL_VAL);
+    as.compare(RAX, RCX);
+    taken.push_back(as.jumpIf(CC_E));
+    as.moveImmediate(RCX, FALSE_VAL);
+    as.compare(RAX, RCX);
+    taken.push_back(as.jumpIf(CC_E));
+#else
+    as.compare32(base, disp + layout.typeOffset, VAL_NIL);
+    taken.push_back(as.jumpIf(CC_E));
+    as.compare32(base, disp + layout.typeOffset, VAL_BOOL);
+    int notBool = as.jumpIf(CC_NE);
+    as.compare8(base, disp + layout.boolOffset, 0);
+    taken.push_back(as.jumpIf(CC_E));
+    as.bind(notBool);
+#endif
+}
+
+// Calls helper(vm, sp, instruction) and carries on with the stack top it returns, or leaves through error
+static void callHelper(Assembler &as, const void *helper, const uint8_t *instruction, int error)
+{
+    as.move(RDI, VMREG);
+    as.move(RSI, SP);
+    as.moveImmediate(RDX, (uint64_t)(uintptr_t)instruction);
+    as.call(helper);
+    as.test(RAX);
+    as.bindTo(as.jumpIf(CC_E), error);
+    as.move(SP, RAX);
+}
+
+/**
+
+    Translates the function's chunk into output.
+    @return bool: false if an instruction has no template, the function then has to be run by the interpreter.
+    */
+bool JitCompiler::compile()
+{
+    std::vector<uint8_t> &bytes = function->chunk->bytes;
+    int size = bytes.size();
+    Assembler as;
+
+    /*
+    Entry: save the callee saved registers the state lives in and jump to the instruction to start at. Five pushes
+    after the return address leave the stack 16 byte aligned for the helper calls.
+    */
+    as.push(RBP);
+    as.push(SP);
+    as.push(SLOTS);
+    as.push(CONSTANTS);
+    as.push(VMREG);
+    as.move(VMREG, RDI);
+    as.move(SP, RSI);
+    as.move(SLOTS, RDX);
+    as.moveImmediate(CONSTANTS, (uint64_t)(uintptr_t)function->chunk->constants.values.data());
+    as.jumpTo(RCX);
+
+    int error = as.position();
+    as.moveResult(INTERPRET_RUNTIME_ERROR);
+    int exit = as.position();
+    as.pop(VMREG);
+    as.pop(CONSTANTS);
+    as.pop(SLOTS);
+    as.pop(SP);
+    as.pop(RBP);
+    as.ret();
+
+    std::vector<int> entries(size, -1);
+    std::vector<std::pair<int, int>> fixups; // jump displacement, bytecode offset it lands on
+    std::vector<int> slow;                    // jumps to the slow path of the current instruction
+    std::vector<int> taken;                   // jumps to the current instruction's jump target
+
+    for (int offset = 0; offset < size; offset += instructionSize(bytes[offset]))
+    {
+        entries[offset] = as.position();
+        const uint8_t *instruction = &bytes[offset];
+        uint8_t op = genericOpcode(bytes[offset]);
+        if (offset + instructionSize(op) > size)
+            return false;
+        int target = function->chunk->jumpTarget(offset);
+
+        switch (op)
+        {
+        case OP_CONSTANT:
+            copyValue(as, SP, 0, CONSTANTS, instruction[1] * VALUE_SIZE);
+            as.add(SP, VALUE_SIZE);
+            break;
+        case OP_NIL:
+            storeValue(as, SP, 0, NIL_VAL);
+            as.add(SP, VALUE_SIZE);
+            break;
+        case OP_TRUE:
+            storeValue(as, SP, 0, BOOL_VAL(true));
+            as.add(SP, VALUE_SIZE);
+            break;
+        case OP_FALSE:
+            storeValue(as, SP, 0, BOOL_VAL(false));
+            as.add(SP, VALUE_SIZE);
+            break;
+        case OP_POP:
+            as.add(SP, -VALUE_SIZE);
+            break;
+        case OP_GET_LOCAL:
+            copyValue(as, SP, 0, SLOTS, instruction[1] * VALUE_SIZE);
+            as.add(SP, VALUE_SIZE);
+            break;
+        case OP_SET_LOCAL:
+            copyValue(as, SLOTS, instruction[1] * VALUE_SIZE, SP, -VALUE_SIZE);
+            break;
+        case OP_GET_LOCAL_2:
+            copyValue(as, SP, 0, SLOTS, instruction[1] * VALUE_SIZE);
+            copyValue(as, SP, VALUE_SIZE, SLOTS, instruction[2] * VALUE_SIZE);
+            as.add(SP, 2 * VALUE_SIZE);
+            break;
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_NOT:
+        case OP_PRINT:
+            callHelper(as, (const void *)jitInstruction, instruction, error);
+            break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        {
+            static const uint8_t arithmetic[] = {0x58, 0x5C, 0x59, 0x5E}; // addsd, subsd, mulsd, divsd
+            checkNumber(as, SP, -2 * VALUE_SIZE, slow);
+            checkNumber(as, SP, -VALUE_SIZE, slow);
+            as.sse(0xF2, 0x10, 0, SP, -2 * VALUE_SIZE + layout.numberOffset);
+            as.sse(0xF2, arithmetic[op - OP_ADD], 0, SP, -VALUE_SIZE + layout.numberOffset);
+            as.sse(0xF2, 0x11, 0, SP, -2 * VALUE_SIZE + layout.numberOffset);
+            canonicalizeResult(as, SP, -2 * VALUE_SIZE + layout.numberOffset);
+            as.add(SP, -VALUE_SIZE);
+            int done = as.jump();
+            as.bindAll(slow);
+            callHelper(as, (const void *)jitInstruction, instruction, error);
+            as.bind(done);
+            break;
+        }
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_GREATER_EQUAL:
+        case OP_LESS_EQUAL:
+        {
+            checkNumber(as, SP, -2 * VALUE_SIZE, slow);
+            checkNumber(as, SP, -VALUE_SIZE, slow);
+            as.sse(0xF2, 0x10, 0, SP, -2 * VALUE_SIZE + layout.numberOffset);
+            as.sse(0xF2, 0x10, 1, SP, -VALUE_SIZE + layout.numberOffset);
+
+            // a < b is b > a, and a >= b is !(a < b) so it has to come out true when either operand is NaN
+            bool less = op == OP_LESS || op == OP_GREATER_EQUAL;
+            bool negated = op == OP_GREATER_EQUAL || op == OP_LESS_EQUAL;
+            if (less)
+                as.compareDoubles(1, 0);
+            else
+                as.compareDoubles(0, 1);
+            int isTrue = as.jumpIf(negated ? CC_BE : CC_A);
+            storeValue(as, SP, -2 * VALUE_SIZE, BOOL_VAL(false));
+            int stored = as.jump();
+            as.bind(isTrue);
+            storeValue(as, SP, -2 * VALUE_SIZE, BOOL_VAL(true));
+            as.bind(stored);
+            as.add(SP, -VALUE_SIZE);
+            int done = as.jump();
+            as.bindAll(slow);
+            callHelper(as, (const void *)jitInstruction, instruction, error);
+            as.bind(done);
+            break;
+        }
+        case OP_NEGATE:
+        {
+            checkNumber(as, SP, -VALUE_SIZE, slow);
+            as.load(RAX, SP, -VALUE_SIZE + layout.numberOffset);
+            as.complementBit(RAX, 63);
+            as.store(SP, -VALUE_SIZE + layout.numberOffset, RAX);
+            int done = as.jump();
+            as.bindAll(slow);
+            callHelper(as, (const void *)jitInstruction, instruction, error);
+            as.bind(done);
+            break;
+        }
+        case OP_ADD_LOCAL_CONSTANT:
+        {
+            int local = instruction[1] * VALUE_SIZE;
+            int constant = instruction[2] * VALUE_SIZE;
+            if (!IS_NUMBER(function->chunk->constants.values[instruction[2]]))
+            {
+                callHelper(as, (const void *)jitInstruction, instruction, error);
+                break;
+            }
+            checkNumber(as, SLOTS, local, slow);
+            as.sse(0xF2, 0x10, 0, SLOTS, local + layout.numberOffset);
+            as.sse(0xF2, 0x58, 0, CONSTANTS, constant + layout.numberOffset);
+            as.sse(0xF2, 0x11, 0, SLOTS, local + layout.numberOffset);
+            canonicalizeResult(as, SLOTS, local + layout.numberOffset);
+            int done = as.jump();
+            as.bindAll(slow);
+            callHelper(as, (const void *)jitInstruction, instruction, error);
+            as.bind(done);
+            break;
+        }
+        case OP_LESS_LOCAL_CONSTANT_JUMP:
+        case OP_GREATER_LOCAL_CONSTANT_JUMP:
+        {
+            int local = instruction[1] * VALUE_SIZE;
+            int constant = instruction[2] * VALUE_SIZE;
+            if (!IS_NUMBER(function->chunk->constants.values[instruction[2]]))
+            {
+                callHelper(as, (const void *)jitInstruction, instruction, error);
+                break;
+            }
+            checkNumber(as, SLOTS, local, slow);
+            as.sse(0xF2, 0x10, 0, SLOTS, local + layout.numberOffset);
+            as.sse(0xF2, 0x10, 1, CONSTANTS, constant + layout.numberOffset);
+            if (op == OP_LESS_LOCAL_CONSTANT_JUMP)
+                as.compareDoubles(1, 0);
+            else
+                as.compareDoubles(0, 1);
+            fixups.push_back({as.jumpIf(CC_BE), target});
+            int done = as.jump();
+            as.bindAll(slow);
+            callHelper(as, (const void *)jitInstruction, instruction, error);
+            as.bind(done);
+            break;
+        }
+        case OP_JUMP:
+        case OP_LOOP:
+            fixups.push_back({as.jump(), target});
+            break;
+        case OP_JUMP_IF_FALSE:
+            jumpIfFalsey(as, SP, -VALUE_SIZE, taken);
+            break;
+        case OP_POP_JUMP_IF_FALSE:
+            as.add(SP, -VALUE_SIZE);
+            jumpIfFalsey(as, SP, 0, taken);
+            break;
+        case OP_CALL:
+            callHelper(as, (const void *)jitCall, instruction, error);
+            break;
+        case OP_RETURN:
+        {
+            as.move(RDI, VMREG);
+            as.move(RSI, SP);
+            as.call((const void *)jitReturn);
+            as.moveResult(INTERPRET_OK);
+            as.bindTo(as.jump(), exit);
+            break;
+        }
+        default:
+            return false;
+        }
+
+        for (int displacement : taken)
+            fixups.push_back({displacement, target});
+        taken.clear();
+    }
+
+    for (auto [displacement, target] : fixups)
+    {
+        if (target < 0 || target >= size || entries[target] == -1)
+            return false;
+        as.bindTo(displacement, entries[target]);
+    }
+
+    void *memory = mmap(NULL, as.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return false;
+    memcpy(memory, as.code.data(), as.code.size());
+    if (mprotect(memory, as.code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, as.code.size());
+        return false;
+    }
+
+    output = std::make_shared<NativeCode>((uint8_t *)memory, as.code.size(), std::move(entries));
+    return true;
+}
+
+#else
+
+NativeCode::NativeCode(uint8_t *code, size_t size, std::vector<int> entries)
+{
+    this->code = code;
+    this->size = size;
+    this->entries = std::move(entries);
+}
+
+NativeCode::~NativeCode()
+{
+}
+
+InterpretResult NativeCode::run(VM &vm, int offset)
+{
+    return INTERPRET_RUNTIME_ERROR;
+}
+
+JitCompiler::JitCompiler(ObjFunction *function)
+{
+    this->function = function;
+}
+
+// there is no native code to generate on this platform, every function stays on the interpreter
+bool JitCompiler::compile()
+{
+    return false;
+}
+
+#endif
+
+//////////////////////////////////////////////////
+// VM
+//////////////////////////////////////////////////
+
+// Translates just the function into native code unless that has been done already, false if it cannot be translated
+bool VM::compileNative(ObjFunction *function)
+{
+    if (function->native != nullptr)
+        return true;
+
+    JitCompiler compiler(function);
+    if (!compiler.compile())
+        return false;
+    function->native = compiler.output;
+    return true;
+}
+
+/**
+
+    Translates a function, and every function declared inside it, into native code unless that has been done already.
+    @return bool: false if any of them cannot be translated.
+    */
+bool VM::prepareNative(ObjFunction *function)
+{
+    if (!compileNative(function))
+        return false;
+
+    for (Value &constant : function->chunk->constants.values)
+    {
+        if (IS_FUNCTION(constant) && !prepareNative(AS_FUNCTION(constant)))
+            return false;
+    }
+    return true;
+}
+
+/*
+Runs the frame on top until it returns, used for calls made by native code. A function that did not translate, e.g.
+one from an earlier REPL line, runs on the interpreter, which returns to the caller once the frame is gone instead of
+running on into the caller's code.
+*/
+InterpretResult VM::runFrame()
+{
+    ObjFunction *function = frames[frameCount - 1].function;
+    if (function->native == nullptr)
+        prepareNative(function);
+    if (function->native != nullptr)
+        return function->native->run(*this, 0);
+
+    int depth = returnDepth;
+    returnDepth = frameCount - 1;
+    InterpretResult result = run();
+    returnDepth = depth;
+    return result;
+}
+
+/*
+Tiering: the interpreter counts the back-edges of every loop and the calls of every function, and compiles the function
+once one of them reaches its threshold. Short scripts never get there and pay for nothing but the counting. A counter
+only triggers when it hits the threshold exactly, so a function that does not translate is tried once per loop and once
+for its calls.
+*/
+
+/**
+
+    Counts a back-edge of the loop starting at header.
+    @return bool: true if the function has native code the frame can switch to at the loop header.
+    */
+bool VM::hotLoop(ObjFunction *function, int header)
+{
+    if (function->native != nullptr)
+        return true;
+
+    std::vector<uint32_t> &counts = function->loopCounts;
+    if (counts.empty())
+        counts.assign(function->chunk->bytes.size(), 0);
+    return ++counts[header] == (uint32_t)hotLoopThreshold && compileNative(function);
+}
+
+/**
+
+    Counts a call of a function that has no native code yet.
+    @return bool: true if the call has just made the function hot and it now has native code.
+    */
+bool VM::hotCall(ObjFunction *function)
+{
+    return ++function->calls == (uint32_t)hotCallThreshold && compileNative(function);
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef simpl_jit_h
+#define simpl_jit_h
+
+#include "common.hh"
+#include "vm.hh"
+
+/**
+
+    @brief A function's bytecode translated into x86-64 machine code by JitCompiler. The code lives in its own
+    executable mapping and can be entered at the start of any bytecode instruction, so the frame on top of the VM does
+    not have to have started there. The native code works on the same VM stack and frames as the interpreter.
+    */
+class NativeCode
+{
+public:
+    uint8_t *code;
+    size_t size;
+    std::vector<int> entries; // where the machine code of each bytecode offset starts, -1 inside an instruction
+
+    NativeCode(uint8_t *code, size_t size, std::vector<int> entries);
+
+    ~NativeCode();
+
+    InterpretResult run(VM &vm, int offset);
+};
+
+/**
+
+    @brief Baseline template JIT: every bytecode instruction is replaced by a fixed piece of machine code, jumps become
+    direct native jumps. Stack, locals and number arithmetic are done inline, anything else (globals, strings,
+    printing, calls and every runtime error) calls back into the VM through a helper, so the results are the same as
+    VM::run()'s. compile() fails for bytecode it has no template for and the function stays on the interpreter.
+    */
+class JitCompiler
+{
+public:
+    ObjFunction *function;
+    std::shared_ptr<NativeCode> output;
+
+    JitCompiler(ObjFunction *function);
+
+    bool compile();
+};
+
+#endif
\ No newline at end of file
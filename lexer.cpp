@@ -1,6 +1,357 @@
 #include "token.hh"
 #include "lexer.hh"
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+Character classes of the lexer, looked up in a table instead of calling the locale dependent ctype functions: letters
+and digits are ASCII only, like in the "C" locale.
+*/
+enum CharClass : uint8_t
+{
+    C_ALPHA = 1,
+    C_DIGIT = 2,
+    C_BLANK = 4, // whitespace between tokens, '\n' included
+};
+
+struct CharClassTable
+{
+    uint8_t classes[256] = {};
+
+    constexpr CharClassTable()
+    {
+        for (int c = 'a'; c <= 'z'; c++)
+            classes[c] |= C_ALPHA;
+        for (int c = 'A'; c <= 'Z'; c++)
+            classes[c] |= C_ALPHA;
+        for (int c = '0'; c <= '9'; c++)
+            classes[c] |= C_DIGIT;
+        classes[(uint8_t)' '] |= C_BLANK;
+        classes[(uint8_t)'\t'] |= C_BLANK;
+        classes[(uint8_t)'\r'] |= C_BLANK;
+        classes[(uint8_t)'\n'] |= C_BLANK;
+    }
+};
+
+static constexpr CharClassTable charClasses;
+
+static inline bool isAlpha(char c)
+{
+    return charClasses.classes[(uint8_t)c] & C_ALPHA;
+}
+
+static inline bool isDigit(char c)
+{
+    return charClasses.classes[(uint8_t)c] & C_DIGIT;
+}
+
+/*
+Scanning runs of characters a block at a time. Each scan stops at the first character of a block where its stop
+predicate holds, and every predicate holds for the '\0' ending the source. Blocks are loaded aligned, so a load never
+crosses into a page the source does not reach into: the bytes it reads past the terminator are on the same page and
+are ignored. The first block is the aligned one containing p, with the bytes before p masked off.
+
+AVX2 is used when the compiler targets it (-mavx2), SSE2 otherwise, which every x86-64 has. Other machines get the
+scalar loops over the class table.
+*/
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#ifdef __AVX2__
+typedef __m256i Block;
+#define BLOCK_SIZE 32
+#define LOAD(p) _mm256_load_si256((const __m256i *)(p))
+#define SPLAT(c) _mm256_set1_epi8(c)
+#define EQUAL(a, b) _mm256_cmpeq_epi8(a, b)
+#define GREATER(a, b) _mm256_cmpgt_epi8(a, b)
+#define OR(a, b) _mm256_or_si256(a, b)
+#define AND(a, b) _mm256_and_si256(a, b)
+#define MASK(a) ((uint32_t)_mm256_movemask_epi8(a))
+#define ALL_BITS 0xFFFFFFFFu
+#else
+typedef __m128i Block;
+#define BLOCK_SIZE 16
+#define LOAD(p) _mm_load_si128((const __m128i *)(p))
+#define SPLAT(c) _mm_set1_epi8(c)
+#define EQUAL(a, b) _mm_cmpeq_epi8(a, b)
+#define GREATER(a, b) _mm_cmpgt_epi8(a, b)
+#define OR(a, b) _mm_or_si128(a, b)
+#define AND(a, b) _mm_and_si128(a, b)
+#define MASK(a) ((uint32_t)_mm_movemask_epi8(a))
+#define ALL_BITS 0xFFFFu
+#endif
+
+// Bytes from low to high, both ASCII; the compare is signed so bytes from 0x80 up are never in range
+#define IN_RANGE(block, low, high) AND(GREATER(block, SPLAT((low) - 1)), GREATER(SPLAT((high) + 1), block))
+
+// Reads past the end of the source by design, see above
+template <typename Stop>
+__attribute__((no_sanitize_address)) static const char *scanUntil(const char *p, Stop stop)
+{
+    uintptr_t misalignment = (uintptr_t)p % BLOCK_SIZE;
+    const char *block = p - misalignment;
+    uint32_t mask = stop(LOAD(block)) >> misalignment;
+    if (mask != 0)
+        return p + __builtin_ctz(mask);
+
+    for (;;)
+    {
+        block += BLOCK_SIZE;
+        mask = stop(LOAD(block));
+        if (mask != 0)
+            return block + __builtin_ctz(mask);
+    }
+}
+
+static const char *skipBlanks(const char *p)
+{
+    return scanUntil(p, [](Block block)
+                     {
+        Block blank = OR(OR(EQUAL(block, SPLAT(' ')), EQUAL(block, SPLAT('\t'))),
+                         OR(EQUAL(block, SPLAT('\r')), EQUAL(block, SPLAT('\n'))));
+        return ~MASK(blank) & ALL_BITS; });
+}
+
+static const char *skipDigits(const char *p)
+{
+    return scanUntil(p, [](Block block)
+                     { return ~MASK(IN_RANGE(block, '0', '9')) & ALL_BITS; });
+}
+
+static const char *skipAlphanumerics(const char *p)
+{
+    return scanUntil(p, [](Block block)
+                     {
+        // setting bit 5 folds upper case letters onto lower case ones and no other byte onto a letter
+        Block letter = IN_RANGE(OR(block, SPLAT(0x20)), 'a', 'z');
+        return ~MASK(OR(letter, IN_RANGE(block, '0', '9'))) & ALL_BITS; });
+}
+
+// The closing quote of a string, or the end of the source
+static const char *findStringEnd(const char *p)
+{
+    return scanUntil(p, [](Block block)
+                     { return MASK(OR(EQUAL(block, SPLAT('"')), EQUAL(block, SPLAT('\0')))); });
+}
+
+// The newline ending a comment, or the end of the source
+static const char *findLineEnd(const char *p)
+{
+    return scanUntil(p, [](Block block)
+                     { return MASK(OR(EQUAL(block, SPLAT('\n')), EQUAL(block, SPLAT('\0')))); });
+}
+
+#undef BLOCK_SIZE
+#undef LOAD
+#undef SPLAT
+#undef EQUAL
+#undef GREATER
+#undef OR
+#undef AND
+#undef MASK
+#undef ALL_BITS
+#undef IN_RANGE
+
+#else
+
+static const char *skipBlanks(const char *p)
+{
+    while (charClasses.classes[(uint8_t)*p] & C_BLANK)
+        p++;
+    return p;
+}
+
+static const char *skipDigits(const char *p)
+{
+    while (isDigit(*p))
+        p++;
+    return p;
+}
+
+static const char *skipAlphanumerics(const char *p)
+{
+    while (isAlpha(*p) || isDigit(*p))
+        p++;
+    return p;
+}
+
+static const char *findStringEnd(const char *p)
+{
+    while (*p != '"' && *p != '\0')
+        p++;
+    return p;
+}
+
+static const char *findLineEnd(const char *p)
+{
+    while (*p != '\n' && *p != '\0')
+        p++;
+    return p;
+}
+
+#endif
+
+static int countNewlines(const char *from, const char *to)
+{
+    return (int)std::count(from, to, '\n');
+}
+
+struct Keyword
+{
+    const char *name;
+    int length;
+    TokenType type;
+};
+
+// Every keyword of token.hh, new ones only need to be added here
+static constexpr Keyword KEYWORDS[] = {
+    {"and", 3, T_AND},
+    {"class", 5, T_CLASS},
+    {"else", 4, T_ELSE},
+    {"false", 5, T_FALSE},
+    {"for", 3, T_FOR},
+    {"fun", 3, T_FUN},
+    {"if", 2, T_IF},
+    {"nil", 3, T_NIL},
+    {"or", 2, T_OR},
+    {"print", 5, T_PRINT},
+    {"return", 6, T_RETURN},
+    {"super", 5, T_SUPER},
+    {"this", 4, T_THIS},
+    {"true", 4, T_TRUE},
+    {"var", 3, T_VAR},
+    {"while", 5, T_WHILE},
+};
+
+static constexpr int KEYWORD_COUNT = sizeof(KEYWORDS) / sizeof(KEYWORDS[0]);
+static constexpr int KEYWORD_BUCKETS = 8;
+
+// The characters of a word of up to 8 packed the way a little endian load puts them in a register
+static constexpr uint64_t packWord(const char *chars, int length)
+{
+    uint64_t word = 0;
+    for (int i = 0; i < length; i++)
+        word |= (uint64_t)(uint8_t)chars[i] << (8 * i);
+    return word;
+}
+
+/*
+Minimal perfect hash over KEYWORDS, built at compile time by hash and displace: a first hash puts each keyword into one
+of KEYWORD_BUCKETS buckets, then every bucket gets the seed for a second hash that sends its keywords to slots no other
+keyword has, one slot per keyword. Buckets are placed largest first while most slots are still free. The keys are the
+first two characters and the length, which tell all keywords apart.
+*/
+struct KeywordHash
+{
+    uint32_t seeds[KEYWORD_BUCKETS] = {};
+    uint64_t words[KEYWORD_COUNT] = {}; // packed characters of the keyword in each slot
+    TokenType types[KEYWORD_COUNT] = {};
+    int minLength = 0;
+    int maxLength = 0;
+    bool complete = false;
+
+    static constexpr uint32_t key(const char *name, int length)
+    {
+        return (uint32_t)(uint8_t)name[0] | (uint32_t)(uint8_t)name[1] << 8 | (uint32_t)length << 16;
+    }
+
+    static constexpr uint32_t mix(uint32_t key, uint32_t seed)
+    {
+        uint32_t hash = (key ^ seed) * 0x9E3779B1u;
+        return hash ^ (hash >> 15);
+    }
+
+    static constexpr int bucket(uint32_t key)
+    {
+        return mix(key, 0) % KEYWORD_BUCKETS;
+    }
+
+    constexpr int slot(const char *name, int length) const
+    {
+        uint32_t k = key(name, length);
+        return mix(k, seeds[bucket(k)]) % KEYWORD_COUNT;
+    }
+
+    constexpr KeywordHash()
+    {
+        minLength = maxLength = KEYWORDS[0].length;
+        int sizes[KEYWORD_BUCKETS] = {};
+        for (const Keyword &keyword : KEYWORDS)
+        {
+            sizes[bucket(key(keyword.name, keyword.length))]++;
+            minLength = std::min(minLength, keyword.length);
+            maxLength = std::max(maxLength, keyword.length);
+        }
+
+        bool used[KEYWORD_COUNT] = {};
+        for (int size = KEYWORD_COUNT; size > 0; size--)
+        {
+            for (int b = 0; b < KEYWORD_BUCKETS; b++)
+            {
+                if (sizes[b] == size && !place(b, used))
+                    return;
+            }
+        }
+        complete = true;
+    }
+
+    // Finds a seed that sends the keywords of the bucket to unused slots
+    constexpr bool place(int b, bool used[])
+    {
+        for (uint32_t attempt = 1; attempt < 1 << 16; attempt++)
+        {
+            seeds[b] = attempt * 0x85EBCA6Bu;
+            bool taken[KEYWORD_COUNT] = {};
+            bool fits = true;
+            for (int i = 0; i < KEYWORD_COUNT && fits; i++)
+            {
+                if (bucket(key(KEYWORDS[i].name, KEYWORDS[i].length)) != b)
+                    continue;
+                int s = slot(KEYWORDS[i].name, KEYWORDS[i].length);
+                fits = !used[s] && !taken[s];
+                taken[s] = true;
+            }
+            if (!fits)
+                continue;
+
+            for (const Keyword &keyword : KEYWORDS)
+            {
+                if (bucket(key(keyword.name, keyword.length)) != b)
+                    continue;
+                int s = slot(keyword.name, keyword.length);
+                used[s] = true;
+                words[s] = packWord(keyword.name, keyword.length);
+                types[s] = keyword.type;
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+static constexpr KeywordHash keywordHash;
+static_assert(keywordHash.complete, "No perfect hash for the keywords, change KEYWORD_BUCKETS");
+static_assert(keywordHash.maxLength < 8, "Keywords must fit a packed word");
+
+/*
+Packs an identifier of at most 7 characters. A single 8 byte load when it stays on p's page: like the block scans it
+may read past the end of the source but never onto a page the source does not reach. The bytes after the identifier
+are masked off.
+*/
+__attribute__((no_sanitize_address)) static uint64_t loadWord(const char *p, int length)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t word;
+    if ((uintptr_t)p % 4096 <= 4096 - sizeof(word))
+    {
+        memcpy(&word, p, sizeof(word));
+        return word & ((1ull << (8 * length)) - 1);
+    }
+#endif
+    return packWord(p, length);
+}
+
 Lexer::Lexer(const char *source)
 {
     this->line = 1;
@@ -19,29 +370,15 @@ void Lexer::skipWhitespace()
 {
     while (true)
     {
-        char c = peek();
-        switch (c)
-        {
-        case ' ':
-        case '\r':
-        case '\t':
-            advance();
-            break;
-        case '\n':
-            line++;
-            advance();
-            break;
-        case '/':
-            // Continues skipping until reaching next line
-            if (peekNext() == '/')
-                while (peek() != '\n' && !isEnd())
-                    advance();
-            else
-                return;
-            break;
-        default:
+        const char *end = skipBlanks(current);
+        line += countNewlines(current, end);
+        current = end;
+
+        // Continues skipping until reaching next line
+        if (current[0] == '/' && current[1] == '/')
+            current = findLineEnd(current + 2);
+        else
             return;
-        }
     }
 }
 
@@ -74,82 +411,24 @@ char Lexer::advance()
     return current[-1];
 }
 
-TokenType Lexer::checkKeyword(int start, int length, const char *remain, TokenType type)
-{
-    if (current - this->start == start + length && memcmp(this->start + start, remain, length) == 0)
-    {
-        return type;
-    }
-
-    return T_ID;
-}
-
 TokenType Lexer::identifierType()
 {
-    switch (start[0])
-    {
-    case 'a':
-        return checkKeyword(1, 2, "nd", T_AND);
-    case 'c':
-        return checkKeyword(1, 4, "lass", T_CLASS);
-    case 'e':
-        return checkKeyword(1, 3, "lse", T_ELSE);
-    case 'f':
-        if (current - start > 1)
-        {
-            switch (start[1])
-            {
-            case 'a':
-                return checkKeyword(2, 3, "lse", T_FALSE);
-            case 'o':
-                return checkKeyword(2, 1, "r", T_FOR);
-            case 'u':
-                return checkKeyword(2, 1, "n", T_FUN);
-            }
-        }
-        break;
-    case 'i':
-        return checkKeyword(1, 1, "f", T_IF);
-    case 'n':
-        return checkKeyword(1, 2, "il", T_NIL);
-    case 'o':
-        return checkKeyword(1, 1, "r", T_OR);
-    case 'p':
-        return checkKeyword(1, 4, "rint", T_PRINT);
-    case 'r':
-        return checkKeyword(1, 5, "eturn", T_RETURN);
-    case 's':
-        return checkKeyword(1, 4, "uper", T_SUPER);
-    case 't':
-        if (current - start > 1)
-        {
-            switch (start[1])
-            {
-            case 'h':
-                return checkKeyword(2, 2, "is", T_THIS);
-            case 'r':
-                return checkKeyword(2, 2, "ue", T_TRUE);
-            }
-        }
-        break;
-    case 'v':
-        return checkKeyword(1, 2, "ar", T_VAR);
-    case 'w':
-        return checkKeyword(1, 4, "hile", T_WHILE);
-    }
+    int length = (int)(current - start);
+    if (length < keywordHash.minLength || length > keywordHash.maxLength)
+        return T_ID;
 
-    return T_ID;
+    // the only keyword that can be this identifier, confirmed with a single compare: the packed words differ in
+    // length too, as no keyword has a '\0' in it
+    int slot = keywordHash.slot(start, length);
+    return loadWord(start, length) == keywordHash.words[slot] ? keywordHash.types[slot] : T_ID;
 }
 
 Token Lexer::string()
 {
-    while (peek() != '"' && !isEnd())
-    {
-        // tracks line within literal
-        if (peek() == '\n')
-            line++;
-        advance();
-    }
+    const char *end = findStringEnd(current);
+    // tracks line within literal
+    line += countNewlines(current, end);
+    current = end;
 
     if (isEnd())
         return Token(T_ERROR, this, "Unterminated string", true);
@@ -161,16 +440,13 @@ Token Lexer::string()
 
 Token Lexer::number()
 {
-    while (isdigit(peek()))
-        advance();
+    current = skipDigits(current);
 
     // check for decimal
-    if (peek() == '.' && isdigit(peekNext()))
+    if (peek() == '.' && isDigit(peekNext()))
     {
         advance();
-
-        while (isdigit(peek()))
-            advance();
+        current = skipDigits(current);
     }
 
     return Token(T_NUM, this, NULL);
@@ -178,8 +454,7 @@ Token Lexer::number()
 
 Token Lexer::identifier()
 {
-    while (isalpha(peek()) || isdigit(peek()))
-        advance();
+    current = skipAlphanumerics(current);
     return Token(identifierType(), this, NULL);
 }
 
@@ -192,11 +467,11 @@ Token Lexer::scanToken()
         return Token(T_EOF, this, NULL);
 
     char c = advance();
-    if (isalpha(c))
+    if (isAlpha(c))
     {
         return identifier();
     }
-    if (isdigit(c))
+    if (isDigit(c))
     {
         return number();
     }
@@ -243,4 +518,68 @@ Token Lexer::scanToken()
     }
 
     return Token(T_ERROR, this, "Unexpected character", true);
-}
\ No newline at end of file
+}
+
+TokenStream::TokenStream(const char *source) : ring(new Block[RING_BLOCKS]), lexer(source)
+{
+    thread = std::thread(&TokenStream::produce, this);
+}
+
+TokenStream::~TokenStream()
+{
+    closed.store(true, std::memory_order_relaxed);
+    thread.join();
+}
+
+// Runs on the lexer thread until T_EOF is published or the consumer closes the stream
+void TokenStream::produce()
+{
+    uint32_t head = 0;
+    for (;;)
+    {
+        while (head - released.load(std::memory_order_acquire) == RING_BLOCKS)
+        {
+            if (closed.load(std::memory_order_relaxed))
+                return;
+            std::this_thread::yield();
+        }
+
+        Block &block = ring[head % RING_BLOCKS];
+        bool end = false;
+        for (block.count = 0; block.count < BLOCK_TOKENS && !end;)
+        {
+            Token token = lexer.scanToken();
+            block.tokens[block.count++] = token;
+            end = token.type == T_EOF;
+        }
+
+        published.store(++head, std::memory_order_release);
+        if (end)
+            return;
+    }
+}
+
+Token TokenStream::next()
+{
+    if (finished)
+        return eof;
+
+    uint32_t tail = released.load(std::memory_order_relaxed);
+    while (published.load(std::memory_order_acquire) == tail)
+        std::this_thread::yield();
+
+    Block &block = ring[tail % RING_BLOCKS];
+    Token token = block.tokens[position++];
+    if (position == block.count)
+    {
+        position = 0;
+        released.store(tail + 1, std::memory_order_release);
+    }
+
+    if (token.type == T_EOF)
+    {
+        finished = true;
+        eof = token;
+    }
+    return token;
+}
@@ -3,6 +3,8 @@
 
 #include "common.hh"
 #include "token.hh"
+#include <atomic>
+#include <thread>
 
 /**
 
@@ -10,8 +12,8 @@
     which can then be used by the Compiler to generate bytecode. It scans through the source code
     character by character, identifying keywords, literals, and identifiers and creating tokens for them.
     The Lexer maintains a current position within the source code and a line number. It skips whitespace
-    characters and keeps track of the start and end of each token. Tokens are stored in a vector for later
-    use by the Compiler. This class plays a critical role in the compilation process and is used 
+    characters and keeps track of the start and end of each token. The Compiler pulls tokens one at a time,
+    or from a TokenStream for large sources. This class plays a critical role in the compilation process and is used 
     extensively by the Compiler.
     */
 
@@ -21,7 +23,6 @@ public:
   int line;
   const char *start;
   const char *current;
-  std::vector<Token> tokens = {};
 
   Lexer(){}
 
@@ -43,8 +44,6 @@ public:
 
   TokenType identifierType();
 
-  TokenType checkKeyword(int start, int length, const char *remain, TokenType type);
-
   char advance();
 
   char peek();
@@ -52,4 +51,54 @@ public:
   char peekNext();
 };
 
+// Sources at least this long are lexed on a thread of their own by a TokenStream
+#define STREAM_MIN_SOURCE (256 * 1024)
+
+/**
+
+    @brief Lexes a source on a thread of its own while the Compiler consumes the tokens, so on large sources lexing and
+    code generation overlap on two cores. The lexer thread fills blocks of tokens into a single producer, single consumer
+    ring and publishes each full block with one release store; the consumer hands a block back the same way once it has
+    read all of it. Either side that finds the ring full or empty yields until the other catches up. After the T_EOF
+    token next() keeps returning it, just like Lexer::scanToken() does at the end of the source.
+    */
+class TokenStream
+{
+public:
+  TokenStream(const char *source);
+
+  ~TokenStream();
+
+  TokenStream(const TokenStream &) = delete;
+
+  TokenStream &operator=(const TokenStream &) = delete;
+
+  Token next();
+
+private:
+  static const int BLOCK_TOKENS = 512;
+  static const uint32_t RING_BLOCKS = 16;
+
+  struct Block
+  {
+    int count;
+    Token tokens[BLOCK_TOKENS];
+  };
+
+  std::unique_ptr<Block[]> ring;
+  alignas(64) std::atomic<uint32_t> published{0}; // blocks the lexer has filled, only ever grows
+  alignas(64) std::atomic<uint32_t> released{0};  // blocks the consumer is done with, only ever grows
+  std::atomic<bool> closed{false};                // the consumer is going away, the lexer stops early
+
+  // consumer side
+  int position = 0; // next token in the oldest unreleased block
+  bool finished = false;
+  Token eof;
+
+  Lexer lexer; // only used by the lexer thread
+  std::thread thread;
+
+  void produce();
+};
+
 #endif
\ No newline at end of file
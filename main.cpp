@@ -2,10 +2,9 @@
 #include "bytecodes.hh"
 #include "debug.hh"
 #include "vm.hh"
+#include "runner.hh"
 
-VM vm = VM();
-
-static void repl()
+static void repl(VM &vm)
 {
     char line[1024];
     for (;;)
@@ -22,47 +21,86 @@ static void repl()
     }
 }
 
-static char *readFile(const char *path)
+static int exitCode(InterpretResult result)
 {
-    FILE *file = fopen(path, "rb");
+    if (result == INTERPRET_COMPILE_ERROR)
+        return 65;
+    if (result == INTERPRET_RUNTIME_ERROR)
+        return 70;
+    return 0;
+}
 
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
+static void runFiles(ScriptRunner &runner, const std::vector<std::string> &paths)
+{
+    int code = 0;
+    for (InterpretResult result : runner.runAll(paths))
+    {
+        code = std::max(code, exitCode(result));
+    }
 
-    char *buffer = (char *)malloc(fileSize + 1);
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    buffer[bytesRead] = '\0';
-    fclose(file);
-    return buffer;
+    if (code != 0)
+        exit(code);
 }
 
-static void runFile(const char *path)
+static void usage()
 {
-    char *source = readFile(path);
-    InterpretResult result = vm.interpret(source);
-    free(source);
-
-    if (result == INTERPRET_COMPILE_ERROR)
-        exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR)
-        exit(70);
+    fprintf(stderr, "Usage: simpl [--trace] [--dump-bytecode] [--no-cache] [--profile-opcodes] [--register-vm] [--jit]"
+                    " [--no-tiering] [--hot-loop N] [--hot-call N] [--jobs N] [path...]\n");
+    exit(64);
 }
 
 int main(int argc, const char *argv[])
 {
-    if (argc == 1)
+    ScriptRunner runner(1);
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++)
     {
-        repl();
+        if (strcmp(argv[i], "--trace") == 0)
+            runner.traceExecution = true;
+        else if (strcmp(argv[i], "--dump-bytecode") == 0)
+            runner.printCode = true;
+        else if (strcmp(argv[i], "--no-cache") == 0)
+            runner.useCache = false;
+        else if (strcmp(argv[i], "--profile-opcodes") == 0)
+            runner.profileOpcodes = true;
+        else if (strcmp(argv[i], "--register-vm") == 0)
+            runner.registerVM = true;
+        else if (strcmp(argv[i], "--jit") == 0)
+            runner.jit = true;
+        else if (strcmp(argv[i], "--no-tiering") == 0)
+            runner.tiering = false;
+        else if (strcmp(argv[i], "--hot-loop") == 0 && i + 1 < argc)
+            runner.hotLoopThreshold = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--hot-call") == 0 && i + 1 < argc)
+            runner.hotCallThreshold = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            runner.threadCount = std::max(1, atoi(argv[++i]));
+        else if (argv[i][0] == '-')
+            usage();
+        else
+            paths.push_back(argv[i]);
     }
-    else if (argc == 2)
+
+    if (paths.empty())
     {
-        runFile(argv[1]);
+        // the VM carries its whole value stack and frame array inline, too much to put on the stack
+        std::unique_ptr<VM> vm = std::make_unique<VM>();
+        vm->traceExecution = runner.traceExecution;
+        vm->printCode = runner.printCode;
+        vm->profileOpcodes = runner.profileOpcodes;
+        vm->registerVM = runner.registerVM;
+        vm->jit = runner.jit;
+        vm->tiering = runner.tiering;
+        vm->hotLoopThreshold = runner.hotLoopThreshold;
+        vm->hotCallThreshold = runner.hotCallThreshold;
+        repl(*vm);
+        if (vm->profileOpcodes)
+            vm->printOpcodeProfile();
     }
     else
     {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        runFiles(runner, paths);
     }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "memory.hh"
+#include "vm.hh"
+
+void markObject(VM &vm, Obj *object)
+{
+    if (object == NULL || object->isMarked)
+        return;
+
+#ifdef DEBUG_LOG_GC
+    printf("%p mark ", (void *)object);
+    printValue(OBJ_VAL(object));
+    printf("\n");
+#endif
+
+    object->isMarked = true;
+    vm.grayStack.push_back(object);
+}
+
+void markValue(VM &vm, Value value)
+{
+    if (IS_OBJ(value))
+        markObject(vm, AS_OBJ(value));
+}
+
+static void markArray(VM &vm, ValueArray &array)
+{
+    for (Value &value : array.values)
+    {
+        markValue(vm, value);
+    }
+}
+
+// Traces the references held by an object that has already been marked
+static void blackenObject(VM &vm, Obj *object)
+{
+#ifdef DEBUG_LOG_GC
+    printf("%p blacken ", (void *)object);
+    printValue(OBJ_VAL(object));
+    printf("\n");
+#endif
+
+    switch (object->type)
+    {
+    case OBJ_FUNCTION:
+    {
+        ObjFunction *function = (ObjFunction *)object;
+        markObject(vm, function->name);
+        markArray(vm, function->chunk->constants);
+        break;
+    }
+    case OBJ_STRING:
+    {
+        ObjString *string = (ObjString *)object;
+        markObject(vm, string->left);
+        markObject(vm, string->right);
+        break;
+    }
+    }
+}
+
+static void markRoots(VM &vm)
+{
+    for (Value *slot = vm.stack; slot < vm.stackTop; slot++)
+    {
+        markValue(vm, *slot);
+    }
+
+    vm.globalNames.markTable(vm);
+    for (Global &global : vm.globals)
+    {
+        markObject(vm, global.name);
+        markValue(vm, global.value);
+    }
+
+    for (int i = 0; i < vm.frameCount; i++)
+    {
+        markObject(vm, vm.frames[i].function);
+    }
+
+    // functions the compiler is still filling in are not reachable from anything else yet
+    if (vm.compiler != nullptr)
+    {
+        for (FunctionScope *scope = vm.compiler->current; scope != nullptr; scope = scope->enclosing)
+        {
+            markObject(vm, scope->function);
+        }
+    }
+}
+
+static void traceReferences(VM &vm)
+{
+    while (!vm.grayStack.empty())
+    {
+        Obj *object = vm.grayStack.back();
+        vm.grayStack.pop_back();
+        blackenObject(vm, object);
+    }
+}
+
+static void sweep(VM &vm)
+{
+    Obj *previous = NULL;
+    Obj *object = vm.objects;
+
+    while (object != NULL)
+    {
+        if (object->isMarked)
+        {
+            object->isMarked = false;
+            previous = object;
+            object = object->next;
+            continue;
+        }
+
+        Obj *unreached = object;
+        object = object->next;
+
+        if (previous != NULL)
+            previous->next = object;
+        else
+            vm.objects = object;
+
+        freeObject(vm, unreached);
+    }
+}
+
+// Scales the growth factor with how much of the heap survived: a mostly live heap is collected less often,
+// a mostly garbage heap more often
+static void adjustThreshold(VM &vm, size_t before)
+{
+    double survival = before == 0 ? 1.0 : (double)vm.bytesAllocated / (double)before;
+
+    if (survival > 0.75)
+        vm.gcGrowFactor = std::min(vm.gcGrowFactor * 1.5, GC_MAX_GROW_FACTOR);
+    else if (survival < 0.25)
+        vm.gcGrowFactor = std::max(vm.gcGrowFactor / 1.5, GC_MIN_GROW_FACTOR);
+
+    vm.nextGC = std::max((size_t)(vm.bytesAllocated * vm.gcGrowFactor), (size_t)GC_INITIAL_THRESHOLD);
+}
+
+void collectGarbage(VM &vm)
+{
+#ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+#endif
+    size_t before = vm.bytesAllocated;
+
+    markRoots(vm);
+    traceReferences(vm);
+    vm.strings.tableRemoveWhite();
+    sweep(vm);
+
+    adjustThreshold(vm, before);
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc end\n");
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+           before - vm.bytesAllocated, before, vm.bytesAllocated, vm.nextGC);
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef simpl_memory_h
+#define simpl_memory_h
+
+#include "common.hh"
+#include "object.hh"
+
+class VM;
+
+// The first collection happens after this many bytes of objects have been allocated
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
+
+// Starting factor the heap threshold is scaled by after a collection
+#define GC_HEAP_GROW_FACTOR 2.0
+
+// Bounds for the adaptive factor the heap threshold is scaled by after every collection
+#define GC_MIN_GROW_FACTOR 1.5
+#define GC_MAX_GROW_FACTOR 4.0
+
+/**
+
+    @brief Tracing mark-sweep collector for the objects on the VM's intrusive object list. Roots are the VM stack,
+    the global slots, the constant pool of the chunk being run and the constant pool of the chunk being compiled.
+    The string intern table is weak: strings only referenced from it are removed before sweeping.
+    */
+
+void markObject(VM &vm, Obj *object);
+
+void markValue(VM &vm, Value value);
+
+void collectGarbage(VM &vm);
+
+#endif
\ No newline at end of file
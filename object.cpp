@@ -1,23 +1,202 @@
 #include "object.hh"
+#include "vm.hh"
+#include "memory.hh"
 
+// Allocates an object of type T and links it into the VM's object list which owns it from then on, extra bytes are
+// allocated right behind the object for its flexible array member.
+// Any collection happens before the new object exists so it never has to be rooted by the caller.
+template <typename T>
+static T *allocateObject(VM &vm, ObjType type, size_t extra = 0)
+{
+    vm.bytesAllocated += sizeof(T) + extra;
+#ifdef DEBUG_STRESS_GC
+    collectGarbage(vm);
+#else
+    if (vm.bytesAllocated > vm.nextGC)
+        collectGarbage(vm);
+#endif
+
+    T *object = new (::operator new(sizeof(T) + extra)) T();
+    object->type = type;
+    object->isMarked = false;
+
+    object->next = vm.objects;
+    vm.objects = object;
+    return object;
+}
+
+// FNV-1a
+uint32_t hashString(const char *chars, int length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
 
-std::shared_ptr<ObjString> makeString(const char* chars, int length)
+// Every string is interned: if an equal string already exists it is returned instead of allocating a new one,
+// which lets tables and valuesEqual compare strings by pointer
+ObjString* makeString(VM &vm, const char* chars, int length)
 {
-    std::shared_ptr<ObjString> stringObj = std::make_shared<ObjString>();
-    stringObj->str = std::string_view(chars).substr(0, length);
+    uint32_t hash = hashString(chars, length);
 
-    // ObjString* interned = vm.strings.tableFindString(stringObj);
-    // if (interned != NULL) return interned;
+    ObjString *interned = vm.strings.tableFindString(chars, length, hash);
+    if (interned != NULL) return interned;
 
+    ObjString *stringObj = allocateObject<ObjString>(vm, OBJ_STRING, length + 1);
+    stringObj->length = length;
+    stringObj->hash = hash;
+    stringObj->interned = true;
+    stringObj->left = NULL;
+    stringObj->right = NULL;
+    stringObj->chars = stringObj->storage;
+    memcpy(stringObj->storage, chars, length);
+    stringObj->storage[length] = '\0';
+
+    vm.strings.tableSet(stringObj, NIL_VAL);
     return stringObj;
 }
 
+// left and right have to be reachable by the collector, making the rope allocates
+ObjString *makeRope(VM &vm, ObjString *left, ObjString *right)
+{
+    ObjString *rope = allocateObject<ObjString>(vm, OBJ_STRING);
+    rope->length = left->length + right->length;
+    rope->hash = 0;
+    rope->interned = false;
+    rope->left = left;
+    rope->right = right;
+    rope->chars = NULL;
+    return rope;
+}
+
+/*
+Copies the characters of a rope into a buffer of its own, once, and lets go of its operands so they can be collected.
+The rope is walked with an explicit stack: a string built in a loop is a rope as deep as the loop ran.
+
+The buffer is counted in bytesAllocated but flattening never collects: it happens in the middle of a comparison whose
+operands are already off the stack, the next object allocated starts the collection if the buffer crossed the threshold.
+*/
+void flattenString(VM &vm, ObjString *string)
+{
+    if (string->chars != NULL)
+        return;
+
+    vm.bytesAllocated += string->length + 1;
+    char *chars = (char *)malloc(string->length + 1);
+    size_t filled = 0;
+    std::vector<ObjString *> pending = {string->right, string->left};
+    while (!pending.empty())
+    {
+        ObjString *piece = pending.back();
+        pending.pop_back();
+        if (piece->chars != NULL)
+        {
+            memcpy(chars + filled, piece->chars, piece->length);
+            filled += piece->length;
+            continue;
+        }
+        pending.push_back(piece->right);
+        pending.push_back(piece->left);
+    }
+    chars[filled] = '\0';
+
+    string->chars = chars;
+    string->hash = hashString(chars, string->length);
+    string->left = NULL;
+    string->right = NULL;
+}
+
+// Two interned strings are equal only if they are the same object, a rope has to be compared by its characters
+bool stringsEqual(VM &vm, ObjString *a, ObjString *b)
+{
+    if (a == b)
+        return true;
+    if ((a->interned && b->interned) || a->length != b->length)
+        return false;
+
+    flattenString(vm, a);
+    flattenString(vm, b);
+    return memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+// The function starts out empty, the compiler (or the bytecode cache) fills in its chunk
+ObjFunction *newFunction(VM &vm)
+{
+    ObjFunction *function = allocateObject<ObjFunction>(vm, OBJ_FUNCTION);
+    function->arity = 0;
+    function->maxStack = 0;
+    function->calls = 0;
+    function->chunk = std::make_shared<ByteArray>();
+    function->name = NULL;
+    return function;
+}
+
+void freeObject(VM &vm, Obj *object)
+{
+    switch (object->type)
+    {
+        case OBJ_FUNCTION:
+        {
+            vm.bytesAllocated -= sizeof(ObjFunction);
+            delete (ObjFunction *)object;
+            break;
+        }
+        case OBJ_STRING:
+        {
+            ObjString *string = (ObjString *)object;
+            // the characters were counted wherever they live, behind the object or in a flattened rope's buffer
+            vm.bytesAllocated -= sizeof(ObjString) + (string->chars != NULL ? string->length + 1 : 0);
+            if (string->chars != string->storage)
+                free(string->chars);
+            string->~ObjString();
+            ::operator delete(string);
+            break;
+        }
+    }
+}
+
+static void printFunction(ObjFunction *function)
+{
+    if (function->name == NULL)
+    {
+        printf("<script>");
+        return;
+    }
+    printf("<fn %s>", function->name->chars);
+}
+
+// A rope is printed piece by piece rather than flattened, printing puts nothing on the VM's heap so it is also safe
+// from the collector's log
+static void printString(ObjString *string)
+{
+    std::vector<ObjString *> pending = {string};
+    while (!pending.empty())
+    {
+        ObjString *piece = pending.back();
+        pending.pop_back();
+        if (piece->chars != NULL)
+        {
+            fwrite(piece->chars, 1, piece->length, stdout);
+            continue;
+        }
+        pending.push_back(piece->right);
+        pending.push_back(piece->left);
+    }
+}
+
 void printObject(Value value)
 {
     switch (OBJ_TYPE(value))
     {
+        case OBJ_FUNCTION:
+            printFunction(AS_FUNCTION(value));
+            break;
         case OBJ_STRING:
-            std::cout << AS_CSTRING(value)->str + '\0';
+            printString(AS_STRING(value));
             break;
     }
 }
\ No newline at end of file
@@ -3,40 +3,94 @@
 
 #include "common.hh"
 #include "values.hh"
+#include "bytearray.hh"
+
+class VM;
+class RegisterCode;
+class NativeCode;
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
+#define IS_FUNCTION(value) isObjType(value, OBJ_FUNCTION)
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
 
-#define AS_STRING(value) (std::static_pointer_cast<ObjString>(AS_OBJ(value)))
-#define AS_CSTRING(value) (std::static_pointer_cast<ObjString>(AS_OBJ(value)))
+#define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ(value))
+#define AS_STRING(value) ((ObjString *)AS_OBJ(value))
+#define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
 
 enum ObjType
 {
+    OBJ_FUNCTION,
     OBJ_STRING,
 };
 
+// Every heap object is linked into the owning VM's object list so it can be freed without reference counting
 class Obj
 {
 public:
     ObjType type;
+    bool isMarked;
     struct Obj *next;
 };
 
 
-// Optimize this -> string view instead of string
+// Concatenations at least this long make a rope instead of copying their operands
+#define ROPE_MIN_LENGTH 64
+
+/**
+
+    @brief A string. The characters of a string made by makeString() are stored right behind the object in the same
+    allocation, chars points at them, so a short key costs one allocation and reading it touches a single block.
+    Strings made from source text or short concatenations are interned, so equal strings are the same object. A long
+    concatenation makes a rope instead: a node pointing at its two operands whose characters are only copied, into a
+    buffer of its own, when it is compared (flattenString()), printing walks the pieces. Building a string piece by
+    piece in a loop then does not copy the whole string every time. Ropes are not interned, valuesEqual() compares them
+    by their characters.
+    */
 class ObjString : public Obj
 {
 public:
-    std::string str;
-    
-    bool operator==(const ObjString &other) const
-    {
-        return str == other.str;
-    }
+    size_t length;
+    uint32_t hash;   // computed once the characters are known
+    bool interned;
+    ObjString *left; // operands of a rope, NULL once it is flattened and for every other string
+    ObjString *right;
+    char *chars;     // null terminated, NULL while the string is an unflattened rope
+    char storage[];  // the characters of a string made by makeString()
+};
+
+/**
+
+    @brief A compiled function. The top level of a script is compiled into a function as well, one without a name.
+    maxStack is the most stack slots the function's code can use, counted from the callee's own slot, so a call can
+    check once up front that the whole frame fits on the VM stack.
+    */
+class ObjFunction : public Obj
+{
+public:
+    int arity;
+    int maxStack;
+    std::shared_ptr<ByteArray> chunk;
+    std::shared_ptr<RegisterCode> registers; // chunk translated for the register VM, only made with --register-vm
+    std::shared_ptr<NativeCode> native;      // chunk translated into machine code, with --jit or once it gets hot
+    uint32_t calls;                          // how often the interpreter called it, until it has native code
+    std::vector<uint32_t> loopCounts;        // back-edges taken per loop, indexed by the offset of the loop header
+    ObjString *name; // NULL for the top level script
 };
 
-std::shared_ptr<ObjString> makeString(const char *chars, int length);
+uint32_t hashString(const char *chars, int length);
+
+ObjString *makeString(VM &vm, const char *chars, int length);
+
+ObjString *makeRope(VM &vm, ObjString *left, ObjString *right);
+
+void flattenString(VM &vm, ObjString *string);
+
+bool stringsEqual(VM &vm, ObjString *a, ObjString *b);
+
+ObjFunction *newFunction(VM &vm);
+
+void freeObject(VM &vm, Obj *object);
 
 void printObject(Value value);
 
@@ -0,0 +1,461 @@
+#include "optimizer.hh"
+#include "bytecodes.hh"
+
+Optimizer::Optimizer(std::shared_ptr<ByteArray> array)
+{
+    bytearray = array;
+}
+
+static bool isJump(uint8_t op)
+{
+    return op == OP_JUMP || op == OP_LOOP || op == OP_JUMP_IF_FALSE || op == OP_POP_JUMP_IF_FALSE ||
+           op == OP_LESS_LOCAL_CONSTANT_JUMP || op == OP_GREATER_LOCAL_CONSTANT_JUMP;
+}
+
+// OP_JUMP and OP_LOOP are the same instruction in opposite directions, encode() picks whichever the layout needs
+static bool isUnconditionalJump(uint8_t op)
+{
+    return op == OP_JUMP || op == OP_LOOP;
+}
+
+/**
+
+    Runs every pass until none of them finds anything left to do and writes the result back into the ByteArray.
+    Nothing is changed if the bytes cannot be decoded or a rewritten jump no longer fits in its operand.
+    @return void
+    */
+void Optimizer::optimize()
+{
+    if (!decode())
+        return;
+
+    bool changed = true;
+    for (int pass = 0; changed && pass < 8; pass++)
+    {
+        changed = false;
+        changed |= fuseComparisons();
+        changed |= fuseConditionalPops();
+        changed |= threadJumps();
+        changed |= removeUselessJumps();
+        changed |= removeUnreachable();
+    }
+
+    // last, the other passes only know the plain opcodes
+    fuseSuperinstructions();
+
+    encode();
+}
+
+/**
+
+    Decodes the ByteArray into the instruction list, resolving jump offsets to instruction indices.
+    @return bool: false if a jump lands in the middle of an instruction.
+    */
+bool Optimizer::decode()
+{
+    std::vector<uint8_t> &bytes = bytearray->bytes;
+    std::vector<int> indexAt(bytes.size() + 1, -1);
+    std::vector<int> targetOffsets;
+
+    code.clear();
+    for (int offset = 0; offset < (int)bytes.size();)
+    {
+        Instruction instruction;
+        instruction.op = bytes[offset];
+        instruction.line = bytearray->lines[offset];
+        instruction.target = -1;
+        instruction.live = true;
+
+        int size = instructionSize(instruction.op);
+        if (offset + size > (int)bytes.size())
+            return false;
+
+        if (size == 2)
+            instruction.operand = bytes[offset + 1];
+        else if (size >= 3)
+            instruction.operand = (uint16_t)(bytes[offset + 1] << 8 | bytes[offset + 2]);
+        else
+            instruction.operand = 0;
+
+        // the 5 byte jumps carry their distance after the slot and constant operand
+        int distance = size == 5 ? (bytes[offset + 3] << 8 | bytes[offset + 4]) : instruction.operand;
+        int sign = instruction.op == OP_LOOP ? -1 : 1;
+        targetOffsets.push_back(isJump(instruction.op) ? offset + size + sign * distance : -1);
+
+        indexAt[offset] = code.size();
+        code.push_back(instruction);
+        offset += size;
+    }
+    // jumping to the very end is allowed and lands one past the last instruction
+    indexAt[bytes.size()] = code.size();
+
+    for (int i = 0; i < (int)code.size(); i++)
+    {
+        if (targetOffsets[i] == -1)
+            continue;
+
+        if (targetOffsets[i] < 0 || targetOffsets[i] > (int)bytes.size() || indexAt[targetOffsets[i]] == -1)
+            return false;
+
+        code[i].target = indexAt[targetOffsets[i]];
+    }
+
+    return true;
+}
+
+/**
+
+    Lays the live instructions back out into bytes and lines. Jumps to removed instructions land on the next live one.
+    @return bool: false (leaving the ByteArray untouched) if a jump distance no longer fits in 16 bits.
+    */
+bool Optimizer::encode()
+{
+    int count = code.size();
+    std::vector<int> offsetOf(count + 1);
+
+    int offset = 0;
+    for (int i = 0; i < count; i++)
+    {
+        offsetOf[i] = offset;
+        if (code[i].live)
+            offset += instructionSize(code[i].op);
+    }
+    offsetOf[count] = offset;
+
+    std::vector<uint8_t> bytes;
+    std::vector<int> lines;
+    bytes.reserve(offset);
+    lines.reserve(offset);
+
+    for (int i = 0; i < count; i++)
+    {
+        Instruction &instruction = code[i];
+        if (!instruction.live)
+            continue;
+
+        uint8_t op = instruction.op;
+        uint16_t operand = instruction.operand;
+        uint16_t jump = 0;
+
+        if (isJump(op))
+        {
+            int from = offsetOf[i] + instructionSize(op);
+            int to = offsetOf[instruction.target];
+            int distance = to - from;
+
+            if (isUnconditionalJump(op))
+                op = distance >= 0 ? OP_JUMP : OP_LOOP;
+            else if (distance < 0)
+                return false;
+
+            distance = distance < 0 ? -distance : distance;
+            if (distance > UINT16_MAX)
+                return false;
+            jump = (uint16_t)distance;
+            if (instructionSize(op) == 3)
+                operand = jump;
+        }
+
+        int size = instructionSize(op);
+        bytes.push_back(op);
+        if (size == 2)
+            bytes.push_back((uint8_t)operand);
+        else if (size >= 3)
+        {
+            bytes.push_back((operand >> 8) & 0xff);
+            bytes.push_back(operand & 0xff);
+        }
+        if (size == 5)
+        {
+            bytes.push_back((jump >> 8) & 0xff);
+            bytes.push_back(jump & 0xff);
+        }
+        lines.insert(lines.end(), size, instruction.line);
+    }
+
+    bytearray->bytes = std::move(bytes);
+    bytearray->lines = std::move(lines);
+    return true;
+}
+
+// Marks every instruction some live jump lands on, an instruction that is a jump target cannot be fused away
+std::vector<bool> Optimizer::jumpTargets()
+{
+    std::vector<bool> targets(code.size() + 1, false);
+    for (Instruction &instruction : code)
+    {
+        if (instruction.live && isJump(instruction.op))
+            targets[nextLive(instruction.target)] = true;
+    }
+    return targets;
+}
+
+// First live instruction at or after index, the instruction count if there is none
+int Optimizer::nextLive(int index)
+{
+    while (index < (int)code.size() && !code[index].live)
+        index++;
+    return index;
+}
+
+/**
+
+    '!=', '>=' and '<=' are compiled as the opposite comparison followed by OP_NOT. Each pair becomes one opcode with the
+    exact same result (OP_GREATER_EQUAL is !(a < b), not a >= b, so NaN compares the same way).
+    @return bool: true if anything was fused.
+    */
+bool Optimizer::fuseComparisons()
+{
+    std::vector<bool> targets = jumpTargets();
+    bool changed = false;
+
+    for (int i = 0; i < (int)code.size(); i++)
+    {
+        if (!code[i].live)
+            continue;
+
+        int next = nextLive(i + 1);
+        if (next == (int)code.size() || code[next].op != OP_NOT || targets[next])
+            continue;
+
+        switch (code[i].op)
+        {
+        case OP_EQUAL:
+            code[i].op = OP_NOT_EQUAL;
+            break;
+        case OP_LESS:
+            code[i].op = OP_GREATER_EQUAL;
+            break;
+        case OP_GREATER:
+            code[i].op = OP_LESS_EQUAL;
+            break;
+        default:
+            continue;
+        }
+
+        code[next].live = false;
+        changed = true;
+    }
+
+    return changed;
+}
+
+/**
+
+    'if' and 'while' emit OP_JUMP_IF_FALSE followed by OP_POP on the true path and land on another OP_POP on the false
+    path, so the condition is popped either way. That becomes a single OP_POP_JUMP_IF_FALSE which pops the condition and
+    jumps past the false path's OP_POP. The OP_POP at the destination is left in place in case anything else reaches it.
+    @return bool: true if anything was fused.
+    */
+bool Optimizer::fuseConditionalPops()
+{
+    std::vector<bool> targets = jumpTargets();
+    bool changed = false;
+
+    for (int i = 0; i < (int)code.size(); i++)
+    {
+        if (!code[i].live || code[i].op != OP_JUMP_IF_FALSE)
+            continue;
+
+        int next = nextLive(i + 1);
+        int destination = nextLive(code[i].target);
+        if (next == (int)code.size() || code[next].op != OP_POP || targets[next])
+            continue;
+        if (destination == (int)code.size() || code[destination].op != OP_POP)
+            continue;
+
+        code[i].op = OP_POP_JUMP_IF_FALSE;
+        code[i].target = destination + 1;
+        code[next].live = false;
+        changed = true;
+    }
+
+    return changed;
+}
+
+/**
+
+    A jump that lands on an unconditional jump can go straight to that jump's destination. OP_JUMP_IF_FALSE landing on
+    another OP_JUMP_IF_FALSE can too, since the condition it leaves on the stack is still false there. Conditional jumps
+    are only ever threaded forwards because there is no backwards conditional opcode.
+    @return bool: true if any jump was retargeted.
+    */
+bool Optimizer::threadJumps()
+{
+    bool changed = false;
+
+    for (int i = 0; i < (int)code.size(); i++)
+    {
+        Instruction &jump = code[i];
+        if (!jump.live || !isJump(jump.op))
+            continue;
+
+        // bounded so a cycle of jumps cannot keep us here
+        for (int hops = 0; hops < (int)code.size(); hops++)
+        {
+            int destination = nextLive(jump.target);
+            if (destination == (int)code.size() || destination == i)
+                break;
+
+            Instruction &landing = code[destination];
+            bool threadable = isUnconditionalJump(landing.op) ||
+                              (jump.op == OP_JUMP_IF_FALSE && landing.op == OP_JUMP_IF_FALSE);
+            if (!threadable || nextLive(landing.target) == destination)
+                break;
+            if (!isUnconditionalJump(jump.op) && landing.target <= i)
+                break;
+
+            jump.target = landing.target;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+/**
+
+    Removes jumps that land on the instruction right after them. A conditional jump of that kind still has to pop its
+    condition if it is an OP_POP_JUMP_IF_FALSE, so that one turns into an OP_POP instead.
+    @return bool: true if any jump was removed.
+    */
+bool Optimizer::removeUselessJumps()
+{
+    bool changed = false;
+
+    for (int i = 0; i < (int)code.size(); i++)
+    {
+        Instruction &jump = code[i];
+        if (!jump.live || !isJump(jump.op) || nextLive(jump.target) != nextLive(i + 1))
+            continue;
+
+        if (jump.op == OP_POP_JUMP_IF_FALSE)
+        {
+            jump.op = OP_POP;
+            jump.target = -1;
+        }
+        else
+        {
+            jump.live = false;
+        }
+        changed = true;
+    }
+
+    return changed;
+}
+
+/**
+
+    Walks the control flow from the first instruction and drops everything it never reaches, such as the code
+    following an unconditional jump that nothing jumps back into.
+    @return bool: true if anything was removed.
+    */
+bool Optimizer::removeUnreachable()
+{
+    int count = code.size();
+    std::vector<bool> reached(count + 1, false);
+    std::vector<int> worklist = {nextLive(0)};
+
+    while (!worklist.empty())
+    {
+        int i = worklist.back();
+        worklist.pop_back();
+        if (i == count || reached[i])
+            continue;
+
+        reached[i] = true;
+        uint8_t op = code[i].op;
+
+        if (isJump(op))
+            worklist.push_back(nextLive(code[i].target));
+
+        if (!isUnconditionalJump(op) && op != OP_RETURN)
+            worklist.push_back(nextLive(i + 1));
+    }
+
+    bool changed = false;
+    for (int i = 0; i < count; i++)
+    {
+        if (code[i].live && !reached[i])
+        {
+            code[i].live = false;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+/**
+
+    Looks for a run of count live instructions starting at the live instruction index, only the first of which may be
+    a jump target so the run can be replaced by one instruction.
+    @return bool: true with the indices of the run in run, false if there is no such run.
+    */
+bool Optimizer::liveRun(int index, int count, const std::vector<bool> &targets, std::vector<int> &run)
+{
+    run.clear();
+    for (int i = index; (int)run.size() < count; i = nextLive(i + 1))
+    {
+        if (i == (int)code.size() || (!run.empty() && targets[i]))
+            return false;
+        run.push_back(i);
+    }
+    return true;
+}
+
+/**
+
+    Replaces the sequences that dominate the opcode pair histogram of loops (see --profile-opcodes) with
+    superinstructions, each doing the work of the whole sequence in one dispatch:
+        i = i + k;      OP_GET_LOCAL, OP_CONSTANT, OP_ADD, OP_SET_LOCAL, OP_POP     -> OP_ADD_LOCAL_CONSTANT
+        while (i < k)   OP_GET_LOCAL, OP_CONSTANT, OP_LESS, OP_POP_JUMP_IF_FALSE    -> OP_LESS_LOCAL_CONSTANT_JUMP
+        while (i > k)   OP_GET_LOCAL, OP_CONSTANT, OP_GREATER, OP_POP_JUMP_IF_FALSE -> OP_GREATER_LOCAL_CONSTANT_JUMP
+        a + b           OP_GET_LOCAL, OP_GET_LOCAL                                  -> OP_GET_LOCAL_2
+    The two operands of the new instructions are packed into operand as high and low byte.
+    @return bool: true if anything was fused.
+    */
+bool Optimizer::fuseSuperinstructions()
+{
+    std::vector<bool> targets = jumpTargets();
+    std::vector<int> run;
+    bool changed = false;
+
+    for (int i = nextLive(0); i < (int)code.size(); i = nextLive(i + 1))
+    {
+        if (code[i].op != OP_GET_LOCAL)
+            continue;
+
+        uint16_t slot = code[i].operand;
+
+        if (liveRun(i, 5, targets, run) && code[run[1]].op == OP_CONSTANT && code[run[2]].op == OP_ADD &&
+            code[run[3]].op == OP_SET_LOCAL && code[run[3]].operand == slot && code[run[4]].op == OP_POP)
+        {
+            code[i].op = OP_ADD_LOCAL_CONSTANT;
+            code[i].operand = (uint16_t)(slot << 8 | code[run[1]].operand);
+        }
+        else if (liveRun(i, 4, targets, run) && code[run[1]].op == OP_CONSTANT &&
+                 (code[run[2]].op == OP_LESS || code[run[2]].op == OP_GREATER) &&
+                 code[run[3]].op == OP_POP_JUMP_IF_FALSE)
+        {
+            code[i].op = code[run[2]].op == OP_LESS ? OP_LESS_LOCAL_CONSTANT_JUMP : OP_GREATER_LOCAL_CONSTANT_JUMP;
+            code[i].operand = (uint16_t)(slot << 8 | code[run[1]].operand);
+            code[i].target = code[run[3]].target;
+        }
+        else if (liveRun(i, 2, targets, run) && code[run[1]].op == OP_GET_LOCAL)
+        {
+            code[i].op = OP_GET_LOCAL_2;
+            code[i].operand = (uint16_t)(slot << 8 | code[run[1]].operand);
+        }
+        else
+            continue;
+
+        for (size_t j = 1; j < run.size(); j++)
+        {
+            code[run[j]].live = false;
+        }
+        changed = true;
+    }
+
+    return changed;
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#ifndef simpl_optimizer_h
+#define simpl_optimizer_h
+
+#include "bytearray.hh"
+
+/**
+
+    @brief A decoded instruction as seen by the Optimizer. Jumps refer to their destination by instruction index rather
+    than byte offset so instructions can be fused or removed without invalidating them; offsets are recomputed when the
+    instructions are encoded back into the ByteArray.
+    */
+struct Instruction
+{
+    uint8_t op;
+    uint16_t operand; // one or two byte operand, unused for simple instructions
+    int line;
+    int target;       // index of the instruction a jump lands on, -1 for anything that is not a jump
+    bool live;
+};
+
+/**
+
+    @brief This class implements a peephole optimization pass that runs over a compiled ByteArray before it is executed.
+    It fuses the two opcode sequences the compiler emits for '!=', '>=', '<=' and for the condition of 'if'/'while' into
+    single opcodes, threads jumps that land on other jumps, removes jumps to the next instruction and drops code that can
+    never be reached. Finally the most frequent instruction sequences are replaced by superinstructions. The lines table
+    is rebuilt alongside the bytes so runtime errors still report the right line.
+    */
+class Optimizer
+{
+public:
+    std::shared_ptr<ByteArray> bytearray;
+    std::vector<Instruction> code;
+
+    Optimizer(std::shared_ptr<ByteArray> array);
+
+    void optimize();
+
+private:
+    bool decode();
+
+    bool encode();
+
+    std::vector<bool> jumpTargets();
+
+    int nextLive(int index);
+
+    bool fuseComparisons();
+
+    bool fuseConditionalPops();
+
+    bool threadJumps();
+
+    bool removeUselessJumps();
+
+    bool removeUnreachable();
+
+    bool liveRun(int index, int count, const std::vector<bool> &targets, std::vector<int> &run);
+
+    bool fuseSuperinstructions();
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,848 @@
+#include "registervm.hh"
+#include "bytecodes.hh"
+#include "object.hh"
+#include "vm.hh"
+
+//////////////////////////////////////////////////
+// Translator
+//////////////////////////////////////////////////
+
+RegisterTranslator::RegisterTranslator(ObjFunction *function)
+{
+    this->function = function;
+}
+
+int RegisterTranslator::emit(uint8_t op, uint16_t a, uint16_t b, uint16_t c)
+{
+    output->code.push_back(RegInstruction{op, a, b, c});
+    output->lines.push_back(line);
+    lastWrite = -1;
+    return output->code.size() - 1;
+}
+
+// Copies the value of a stack position into the register of that position, if it is not there already
+void RegisterTranslator::materialize(int position)
+{
+    if (stack[position] == position)
+        return;
+    emit(R_MOVE, position, stack[position], 0);
+    stack[position] = position;
+}
+
+void RegisterTranslator::materializeAll()
+{
+    for (int position = 0; position < (int)stack.size(); position++)
+    {
+        materialize(position);
+    }
+}
+
+// Before reg is overwritten every stack position still reading it gets a copy of the old value
+void RegisterTranslator::materializeAliases(uint16_t reg)
+{
+    for (int position = 0; position < (int)stack.size(); position++)
+    {
+        if (position != reg && stack[position] == reg)
+            materialize(position);
+    }
+}
+
+uint16_t RegisterTranslator::pop()
+{
+    uint16_t operand = stack.back();
+    stack.pop_back();
+    return operand;
+}
+
+// Pushes a value that the next emitted instruction writes into the register of its stack position
+void RegisterTranslator::pushTemporary()
+{
+    stack.push_back(stack.size());
+}
+
+/*
+Assigns value to a local. When value was just computed into a temporary (i = i + 1), the instruction computing it
+writes the local directly instead of going through the temporary.
+*/
+void RegisterTranslator::setLocal(uint16_t slot, uint16_t value)
+{
+    if (value == slot)
+        return;
+
+    bool aliased = false;
+    for (int position = 0; position < (int)stack.size(); position++)
+    {
+        aliased |= position != slot && stack[position] == slot;
+    }
+
+    int top = stack.size() - 1;
+    if (!aliased && lastWrite != -1 && lastWrite == (int)output->code.size() - 1 && value == top &&
+        output->code.back().a == top)
+    {
+        output->code.back().a = slot;
+    }
+    else
+    {
+        materializeAliases(slot);
+        emit(R_MOVE, slot, value, 0);
+    }
+    stack[slot] = slot;
+}
+
+static uint8_t binaryOpcode(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_EQUAL:
+        return R_EQUAL;
+    case OP_NOT_EQUAL:
+        return R_NOT_EQUAL;
+    case OP_GREATER:
+        return R_GREATER;
+    case OP_LESS:
+        return R_LESS;
+    case OP_GREATER_EQUAL:
+        return R_GREATER_EQUAL;
+    case OP_LESS_EQUAL:
+        return R_LESS_EQUAL;
+    case OP_ADD:
+        return R_ADD;
+    case OP_SUBTRACT:
+        return R_SUBTRACT;
+    case OP_MULTIPLY:
+        return R_MULTIPLY;
+    case OP_DIVIDE:
+        return R_DIVIDE;
+    default:
+        return UINT8_MAX;
+    }
+}
+
+/**
+
+    Translates the function's chunk into output.
+    @return bool: false if the code cannot be expressed in registers, e.g. its frame needs more than REG_CONSTANT slots.
+    */
+bool RegisterTranslator::translate()
+{
+    ByteArray &chunk = *function->chunk;
+    std::vector<uint8_t> &bytes = chunk.bytes;
+    int size = bytes.size();
+
+    if (function->maxStack > REG_CONSTANT)
+        return false;
+
+    std::vector<int> depthAt = chunk.stackDepths(function->arity + 1);
+    std::vector<bool> isTarget(size + 1, false);
+    for (int offset = 0; offset < size; offset += instructionSize(bytes[offset]))
+    {
+        int target = chunk.jumpTarget(offset);
+        if (target == -1 || depthAt[offset] == -1)
+            continue;
+        // the stack code never jumps past its final return, there would be no instruction to land on
+        if (target >= size)
+            return false;
+        isTarget[target] = true;
+    }
+
+    output = std::make_shared<RegisterCode>();
+    std::vector<int> labels(size, -1);
+    std::vector<std::pair<int, int>> fixups; // register instruction, stack code offset its jump lands on
+
+    // the callee and the arguments are already in their registers
+    stack.clear();
+    for (int position = 0; position <= function->arity; position++)
+    {
+        stack.push_back(position);
+    }
+
+    bool fallsThrough = true; // whether the previous instruction can continue into this one
+    for (int offset = 0; offset < size; offset += instructionSize(bytes[offset]))
+    {
+        if (depthAt[offset] == -1)
+        {
+            fallsThrough = false;
+            continue;
+        }
+
+        line = chunk.lines[offset];
+        if (!fallsThrough)
+        {
+            // only reached by jumps, which left every value in its own register
+            stack.resize(depthAt[offset]);
+            for (int position = 0; position < (int)stack.size(); position++)
+            {
+                stack[position] = position;
+            }
+        }
+        else if (isTarget[offset])
+            materializeAll();
+
+        if (isTarget[offset] || !fallsThrough)
+        {
+            labels[offset] = output->code.size();
+            lastWrite = -1;
+        }
+        if ((int)stack.size() != depthAt[offset])
+            return false;
+        fallsThrough = true;
+
+        // code that already ran on the stack VM (an earlier REPL line) may have been quickened
+        uint8_t op = genericOpcode(bytes[offset]);
+        uint16_t operand = 0;
+        if (instructionSize(op) == 2)
+            operand = bytes[offset + 1];
+        else if (instructionSize(op) >= 3)
+            operand = (uint16_t)(bytes[offset + 1] << 8 | bytes[offset + 2]);
+
+        int target = chunk.jumpTarget(offset);
+        int top = stack.size() - 1;
+
+        switch (op)
+        {
+        case OP_CONSTANT:
+            stack.push_back(REG_CONSTANT + operand);
+            break;
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            pushTemporary();
+            lastWrite = emit(op == OP_NIL ? R_NIL : op == OP_TRUE ? R_TRUE : R_FALSE, top + 1, 0, 0);
+            break;
+        case OP_POP:
+            pop();
+            break;
+        case OP_GET_LOCAL:
+            materialize(operand);
+            stack.push_back(operand);
+            break;
+        case OP_GET_LOCAL_2:
+            // one get after the other: the second slot can be the one the first get pushes (var b = a; b - 1)
+            materialize(operand >> 8);
+            stack.push_back(operand >> 8);
+            materialize(operand & 0xff);
+            stack.push_back(operand & 0xff);
+            break;
+        case OP_SET_LOCAL:
+            setLocal(operand, stack.back());
+            stack.back() = operand;
+            break;
+        case OP_ADD_LOCAL_CONSTANT:
+        {
+            uint16_t slot = operand >> 8;
+            materialize(slot);
+            materializeAliases(slot);
+            emit(R_ADD, slot, slot, REG_CONSTANT + (operand & 0xff));
+            break;
+        }
+        case OP_GET_GLOBAL:
+            pushTemporary();
+            lastWrite = emit(R_GET_GLOBAL, top + 1, operand, 0);
+            break;
+        case OP_SET_GLOBAL:
+            emit(R_SET_GLOBAL, 0, operand, stack.back());
+            break;
+        case OP_DEFINE_GLOBAL:
+            emit(R_DEFINE_GLOBAL, 0, operand, pop());
+            break;
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_GREATER_EQUAL:
+        case OP_LESS_EQUAL:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        {
+            uint16_t right = pop();
+            uint16_t left = pop();
+            pushTemporary();
+            lastWrite = emit(binaryOpcode(op), top - 1, left, right);
+            break;
+        }
+        case OP_NOT:
+        case OP_NEGATE:
+        {
+            uint16_t operandValue = pop();
+            pushTemporary();
+            lastWrite = emit(op == OP_NOT ? R_NOT : R_NEGATE, top, operandValue, 0);
+            break;
+        }
+        case OP_PRINT:
+            emit(R_PRINT, 0, pop(), 0);
+            break;
+        case OP_CALL:
+        {
+            // the callee and its arguments have to sit in consecutive registers, where the callee's frame begins
+            int callee = top - operand;
+            for (int position = callee; position <= top; position++)
+            {
+                materialize(position);
+            }
+            emit(R_CALL, callee, operand, 0);
+            stack.resize(callee);
+            pushTemporary();
+            break;
+        }
+        case OP_RETURN:
+            emit(R_RETURN, 0, pop(), 0);
+            fallsThrough = false;
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            materializeAll();
+            fixups.push_back({emit(R_JUMP, 0, 0, 0), target});
+            fallsThrough = false;
+            break;
+        case OP_JUMP_IF_FALSE:
+            materializeAll();
+            fixups.push_back({emit(R_JUMP_IF_FALSE, 0, stack.back(), 0), target});
+            break;
+        case OP_POP_JUMP_IF_FALSE:
+        {
+            // a comparison only computed to be tested becomes a compare and branch
+            RegInstruction &last = output->code.back();
+            if (lastWrite != -1 && lastWrite == (int)output->code.size() - 1 && last.a == top &&
+                (last.op == R_LESS || last.op == R_GREATER))
+            {
+                RegInstruction compare = last;
+                output->code.pop_back();
+                output->lines.pop_back();
+                pop();
+                materializeAll();
+                uint8_t branch = compare.op == R_LESS ? R_JUMP_IF_NOT_LESS : R_JUMP_IF_NOT_GREATER;
+                fixups.push_back({emit(branch, 0, compare.b, compare.c), target});
+                break;
+            }
+
+            uint16_t condition = pop();
+            materializeAll();
+            fixups.push_back({emit(R_JUMP_IF_FALSE, 0, condition, 0), target});
+            break;
+        }
+        case OP_LESS_LOCAL_CONSTANT_JUMP:
+        case OP_GREATER_LOCAL_CONSTANT_JUMP:
+        {
+            uint8_t branch = op == OP_LESS_LOCAL_CONSTANT_JUMP ? R_JUMP_IF_NOT_LESS : R_JUMP_IF_NOT_GREATER;
+            materializeAll();
+            fixups.push_back({emit(branch, 0, operand >> 8, REG_CONSTANT + (operand & 0xff)), target});
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    for (auto &fixup : fixups)
+    {
+        if (labels[fixup.second] == -1)
+            return false;
+        output->code[fixup.first].a = labels[fixup.second];
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////
+// Disassembler
+//////////////////////////////////////////////////
+
+static const char *registerOpcodeNames[] = {
+    "R_MOVE", "R_NIL", "R_TRUE", "R_FALSE", "R_GET_GLOBAL", "R_SET_GLOBAL", "R_DEFINE_GLOBAL", "R_EQUAL",
+    "R_NOT_EQUAL", "R_GREATER", "R_LESS", "R_GREATER_EQUAL", "R_LESS_EQUAL", "R_ADD", "R_SUBTRACT", "R_MULTIPLY",
+    "R_DIVIDE", "R_NOT", "R_NEGATE", "R_PRINT", "R_JUMP", "R_JUMP_IF_FALSE", "R_JUMP_IF_NOT_LESS",
+    "R_JUMP_IF_NOT_GREATER", "R_CALL", "R_RETURN",
+};
+static_assert(sizeof(registerOpcodeNames) / sizeof(registerOpcodeNames[0]) == R_RETURN + 1,
+              "registerOpcodeNames is missing an opcode");
+
+static void printOperand(uint16_t operand, ValueArray &constants)
+{
+    if (operand < REG_CONSTANT)
+    {
+        printf(" r%d", operand);
+        return;
+    }
+    printf(" '");
+    printValue(constants.values[operand - REG_CONSTANT]);
+    printf("'");
+}
+
+void RegisterCode::disassemble(const char *name, ValueArray &constants)
+{
+    printf("== %s ==\n", name);
+
+    for (int i = 0; i < (int)code.size(); i++)
+    {
+        RegInstruction &instruction = code[i];
+        printf("%04d ", i);
+        if (i > 0 && lines[i] == lines[i - 1])
+            printf("    | ");
+        else
+            printf("%4d ", lines[i]);
+
+        printf("%-22s", registerOpcodeNames[instruction.op]);
+        switch (instruction.op)
+        {
+        case R_NIL:
+        case R_TRUE:
+        case R_FALSE:
+            printf(" r%d", instruction.a);
+            break;
+        case R_MOVE:
+        case R_NOT:
+        case R_NEGATE:
+            printf(" r%d", instruction.a);
+            printOperand(instruction.b, constants);
+            break;
+        case R_GET_GLOBAL:
+            printf(" r%d g%d", instruction.a, instruction.b);
+            break;
+        case R_SET_GLOBAL:
+        case R_DEFINE_GLOBAL:
+            printf(" g%d", instruction.b);
+            printOperand(instruction.c, constants);
+            break;
+        case R_PRINT:
+        case R_RETURN:
+            printOperand(instruction.b, constants);
+            break;
+        case R_JUMP:
+            printf(" -> %d", instruction.a);
+            break;
+        case R_JUMP_IF_FALSE:
+            printOperand(instruction.b, constants);
+            printf(" -> %d", instruction.a);
+            break;
+        case R_JUMP_IF_NOT_LESS:
+        case R_JUMP_IF_NOT_GREATER:
+            printOperand(instruction.b, constants);
+            printOperand(instruction.c, constants);
+            printf(" -> %d", instruction.a);
+            break;
+        case R_CALL:
+            printf(" r%d %d", instruction.a, instruction.b);
+            break;
+        default:
+            printf(" r%d", instruction.a);
+            printOperand(instruction.b, constants);
+            printOperand(instruction.c, constants);
+            break;
+        }
+        printf("\n");
+    }
+}
+
+//////////////////////////////////////////////////
+// VM
+//////////////////////////////////////////////////
+
+// Translates function and every function declared in it, false if any of them cannot run on the register VM
+bool VM::prepareRegisters(ObjFunction *function)
+{
+    if (function->registers == nullptr)
+    {
+        RegisterTranslator translator(function);
+        if (!translator.translate())
+            return false;
+        function->registers = translator.output;
+
+        if (printCode)
+        {
+            std::string title = function->name != NULL ? function->name->chars : "<script>";
+            title += " (registers)";
+            function->registers->disassemble(title.c_str(), function->chunk->constants);
+        }
+    }
+
+    for (Value &constant : function->chunk->constants.values)
+    {
+        if (IS_FUNCTION(constant) && !prepareRegisters(AS_FUNCTION(constant)))
+            return false;
+    }
+    return true;
+}
+
+/*
+Calls a function that did not translate from register code. Its frame and every call made from it run on the stack
+interpreter until it returns, which leaves the result in the callee's slot: the register that held the callee.
+*/
+InterpretResult VM::callInterpreter(ObjFunction *function, int argCount)
+{
+    int depth = returnDepth;
+    returnDepth = frameCount;
+    runningRegisters = false;
+    InterpretResult result = call(function, argCount) ? run() : INTERPRET_RUNTIME_ERROR;
+    runningRegisters = true;
+    returnDepth = depth;
+    return result;
+}
+
+/*
+The highest slot the registers of any active frame reach. Registers are not pushed and popped, so instead of the stack
+top the collector scans up to here; every frame clears its registers when it starts so nothing stale is ever in range.
+*/
+Value *VM::registerTop()
+{
+    Value *top = stack;
+    for (int i = 0; i < frameCount; i++)
+    {
+        top = std::max(top, frames[i].slots + frames[i].function->maxStack);
+    }
+    return top;
+}
+
+// Sets every register of the frame on top that does not hold an argument to nil
+void VM::clearRegisters(int argCount)
+{
+    CallFrame *frame = &frames[frameCount - 1];
+    for (Value *slot = frame->slots + argCount + 1; slot < frame->slots + frame->function->maxStack; slot++)
+    {
+        *slot = NIL_VAL;
+    }
+}
+
+/*
+The register VM's interpreter loop. Same structure and the same results as execute(): the hot state lives in locals,
+every frame is a window of the VM stack and runtime errors report the same messages.
+*/
+InterpretResult VM::executeRegisters()
+{
+    CallFrame *frame;
+    const RegInstruction *code;
+    const RegInstruction *ip;
+    const RegInstruction *instruction;
+    Value *slots;
+    Value *constants;
+
+#define LOAD_FRAME()                                                 \
+    do                                                               \
+    {                                                                \
+        frame = &frames[frameCount - 1];                             \
+        code = frame->function->registers->code.data();              \
+        ip = frame->registerIp;                                      \
+        slots = frame->slots;                                        \
+        constants = frame->function->chunk->constants.values.data(); \
+    } while (false)
+#define STORE_FRAME() (frame->registerIp = ip)
+
+#define RK(operand) ((operand) < REG_CONSTANT ? slots[operand] : constants[(operand) - REG_CONSTANT])
+#define RUNTIME_ERROR(...)               \
+    do                                   \
+    {                                    \
+        STORE_FRAME();                   \
+        runtimeError(__VA_ARGS__);       \
+        return INTERPRET_RUNTIME_ERROR;  \
+    } while (false)
+#define BINARY_OP(valueType, op)                          \
+    do                                                    \
+    {                                                     \
+        Value b = RK(instruction->b);                     \
+        Value c = RK(instruction->c);                     \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c))               \
+            RUNTIME_ERROR("Operands must be numbers.");   \
+        slots[instruction->a] = valueType(AS_NUMBER(b) op AS_NUMBER(c)); \
+    } while (false)
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+#ifdef COMPUTED_GOTO
+    // Must list a label for every opcode in the same order as the RegOpCode enum
+    static const void *dispatchTable[] = {
+        &&L_R_MOVE,
+        &&L_R_NIL,
+        &&L_R_TRUE,
+        &&L_R_FALSE,
+        &&L_R_GET_GLOBAL,
+        &&L_R_SET_GLOBAL,
+        &&L_R_DEFINE_GLOBAL,
+        &&L_R_EQUAL,
+        &&L_R_NOT_EQUAL,
+        &&L_R_GREATER,
+        &&L_R_LESS,
+        &&L_R_GREATER_EQUAL,
+        &&L_R_LESS_EQUAL,
+        &&L_R_ADD,
+        &&L_R_SUBTRACT,
+        &&L_R_MULTIPLY,
+        &&L_R_DIVIDE,
+        &&L_R_NOT,
+        &&L_R_NEGATE,
+        &&L_R_PRINT,
+        &&L_R_JUMP,
+        &&L_R_JUMP_IF_FALSE,
+        &&L_R_JUMP_IF_NOT_LESS,
+        &&L_R_JUMP_IF_NOT_GREATER,
+        &&L_R_CALL,
+        &&L_R_RETURN,
+    };
+    static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == R_RETURN + 1, "dispatchTable is missing an opcode");
+
+#define CASE(op) L_##op:
+#define DISPATCH()                                  \
+    do                                              \
+    {                                               \
+        instruction = ip++;                         \
+        goto *dispatchTable[instruction->op];       \
+    } while (false)
+#else
+#define CASE(op) case op:
+#define DISPATCH() continue
+#endif
+
+    LOAD_FRAME();
+
+#ifdef COMPUTED_GOTO
+    DISPATCH();
+#else
+    for (;;)
+    {
+        instruction = ip++;
+        switch (instruction->op)
+        {
+#endif
+        CASE(R_MOVE)
+        {
+            slots[instruction->a] = RK(instruction->b);
+            DISPATCH();
+        }
+
+        CASE(R_NIL)
+        {
+            slots[instruction->a] = NIL_VAL;
+            DISPATCH();
+        }
+
+        CASE(R_TRUE)
+        {
+            slots[instruction->a] = BOOL_VAL(true);
+            DISPATCH();
+        }
+
+        CASE(R_FALSE)
+        {
+            slots[instruction->a] = BOOL_VAL(false);
+            DISPATCH();
+        }
+
+        CASE(R_GET_GLOBAL)
+        {
+            Global &global = globals[instruction->b];
+            if (!global.defined)
+                RUNTIME_ERROR("Undefined variable '%s'.", global.name->chars);
+            slots[instruction->a] = global.value;
+            DISPATCH();
+        }
+
+        CASE(R_SET_GLOBAL)
+        {
+            Global &global = globals[instruction->b];
+            if (!global.defined)
+                RUNTIME_ERROR("Undefined variable '%s'", global.name->chars);
+            global.value = RK(instruction->c);
+            DISPATCH();
+        }
+
+        CASE(R_DEFINE_GLOBAL)
+        {
+            Global &global = globals[instruction->b];
+            global.value = RK(instruction->c);
+            global.defined = true;
+            DISPATCH();
+        }
+
+        CASE(R_EQUAL)
+        {
+            slots[instruction->a] = BOOL_VAL(valuesEqual(*this, RK(instruction->b), RK(instruction->c)));
+            DISPATCH();
+        }
+
+        CASE(R_NOT_EQUAL)
+        {
+            slots[instruction->a] = BOOL_VAL(!valuesEqual(*this, RK(instruction->b), RK(instruction->c)));
+            DISPATCH();
+        }
+
+        CASE(R_GREATER)
+        {
+            BINARY_OP(BOOL_VAL, >);
+            DISPATCH();
+        }
+
+        CASE(R_LESS)
+        {
+            BINARY_OP(BOOL_VAL, <);
+            DISPATCH();
+        }
+
+        CASE(R_GREATER_EQUAL)
+        {
+            BINARY_OP(NOT_BOOL_VAL, <);
+            DISPATCH();
+        }
+
+        CASE(R_LESS_EQUAL)
+        {
+            BINARY_OP(NOT_BOOL_VAL, >);
+            DISPATCH();
+        }
+
+        CASE(R_ADD)
+        {
+            Value b = RK(instruction->b);
+            Value c = RK(instruction->c);
+            if (IS_NUMBER(b) && IS_NUMBER(c))
+            {
+                slots[instruction->a] = ARITHMETIC_VAL(AS_NUMBER(b) + AS_NUMBER(c));
+            }
+            else if (IS_STRING(b) && IS_STRING(c))
+            {
+                // the operands are in scanned registers or the constant pool while the result is allocated
+                STORE_FRAME();
+                stackTop = registerTop();
+                slots[instruction->a] = concatenate(AS_STRING(b), AS_STRING(c));
+            }
+            else
+            {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
+            }
+            DISPATCH();
+        }
+
+        CASE(R_SUBTRACT)
+        {
+            BINARY_OP(ARITHMETIC_VAL, -);
+            DISPATCH();
+        }
+
+        CASE(R_MULTIPLY)
+        {
+            BINARY_OP(ARITHMETIC_VAL, *);
+            DISPATCH();
+        }
+
+        CASE(R_DIVIDE)
+        {
+            BINARY_OP(ARITHMETIC_VAL, /);
+            DISPATCH();
+        }
+
+        CASE(R_NOT)
+        {
+            slots[instruction->a] = BOOL_VAL(isFalsey(RK(instruction->b)));
+            DISPATCH();
+        }
+
+        CASE(R_NEGATE)
+        {
+            Value b = RK(instruction->b);
+            if (!IS_NUMBER(b))
+                RUNTIME_ERROR("Operand must be a number.");
+            slots[instruction->a] = NUMBER_VAL(-AS_NUMBER(b));
+            DISPATCH();
+        }
+
+        CASE(R_PRINT)
+        {
+            printValue(RK(instruction->b));
+            std::cout << '\n';
+            DISPATCH();
+        }
+
+        CASE(R_JUMP)
+        {
+            ip = code + instruction->a;
+            DISPATCH();
+        }
+
+        CASE(R_JUMP_IF_FALSE)
+        {
+            if (isFalsey(RK(instruction->b)))
+                ip = code + instruction->a;
+            DISPATCH();
+        }
+
+        CASE(R_JUMP_IF_NOT_LESS)
+        {
+            Value b = RK(instruction->b);
+            Value c = RK(instruction->c);
+            if (!IS_NUMBER(b) || !IS_NUMBER(c))
+                RUNTIME_ERROR("Operands must be numbers.");
+            if (!(AS_NUMBER(b) < AS_NUMBER(c)))
+                ip = code + instruction->a;
+            DISPATCH();
+        }
+
+        CASE(R_JUMP_IF_NOT_GREATER)
+        {
+            Value b = RK(instruction->b);
+            Value c = RK(instruction->c);
+            if (!IS_NUMBER(b) || !IS_NUMBER(c))
+                RUNTIME_ERROR("Operands must be numbers.");
+            if (!(AS_NUMBER(b) > AS_NUMBER(c)))
+                ip = code + instruction->a;
+            DISPATCH();
+        }
+
+        CASE(R_CALL)
+        {
+            Value callee = slots[instruction->a];
+            int argCount = instruction->b;
+
+            STORE_FRAME();
+            stackTop = slots + instruction->a + argCount + 1;
+
+            // a function from an earlier REPL line may not have been translated yet, one that does not translate runs
+            // on the interpreter instead
+            if (IS_FUNCTION(callee) && AS_FUNCTION(callee)->registers == nullptr)
+            {
+                ObjFunction *function = AS_FUNCTION(callee);
+                prepareRegisters(function);
+                if (function->registers == nullptr)
+                {
+                    if (callInterpreter(function, argCount) != INTERPRET_OK)
+                        return INTERPRET_RUNTIME_ERROR;
+                    LOAD_FRAME();
+                    DISPATCH();
+                }
+            }
+
+            if (!callValue(callee, argCount))
+                return INTERPRET_RUNTIME_ERROR;
+            clearRegisters(argCount);
+            LOAD_FRAME();
+            DISPATCH();
+        }
+
+        CASE(R_RETURN)
+        {
+            Value result = RK(instruction->b);
+            frameCount--;
+
+            // returning from the script itself exits the interpreter
+            if (frameCount == 0)
+            {
+                resetStack();
+                return INTERPRET_OK;
+            }
+
+            // the callee's register 0 is the caller's register that held it
+            slots[0] = result;
+            LOAD_FRAME();
+            DISPATCH();
+        }
+#ifndef COMPUTED_GOTO
+        }
+    }
+#endif
+
+#undef LOAD_FRAME
+#undef STORE_FRAME
+#undef RK
+#undef RUNTIME_ERROR
+#undef BINARY_OP
+#undef NOT_BOOL_VAL
+#undef CASE
+#undef DISPATCH
+}
\ No newline at end of file
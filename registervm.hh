@@ -0,0 +1,108 @@
+#ifndef simpl_registervm_h
+#define simpl_registervm_h
+
+#include "common.hh"
+#include "bytearray.hh"
+
+class ObjFunction;
+
+// An RK operand below this is a register (a slot of the frame), from it on it is constant (RK - REG_CONSTANT)
+#define REG_CONSTANT 256
+
+/*
+Three-address instructions of the register VM. A, B and C are the operands of RegInstruction, RK(x) reads register x or
+a constant, see REG_CONSTANT.
+*/
+enum RegOpCode
+{
+    R_MOVE,                // A = RK(B)
+    R_NIL,                 // A = nil
+    R_TRUE,                // A = true
+    R_FALSE,               // A = false
+    R_GET_GLOBAL,          // A = globals[B]
+    R_SET_GLOBAL,          // globals[B] = RK(C), the global has to be defined already
+    R_DEFINE_GLOBAL,       // globals[B] = RK(C)
+    R_EQUAL,               // A = RK(B) == RK(C)
+    R_NOT_EQUAL,           // A = RK(B) != RK(C)
+    R_GREATER,             // A = RK(B) > RK(C)
+    R_LESS,                // A = RK(B) < RK(C)
+    R_GREATER_EQUAL,       // A = !(RK(B) < RK(C))
+    R_LESS_EQUAL,          // A = !(RK(B) > RK(C))
+    R_ADD,                 // A = RK(B) + RK(C)
+    R_SUBTRACT,            // A = RK(B) - RK(C)
+    R_MULTIPLY,            // A = RK(B) * RK(C)
+    R_DIVIDE,              // A = RK(B) / RK(C)
+    R_NOT,                 // A = !RK(B)
+    R_NEGATE,              // A = -RK(B)
+    R_PRINT,               // print RK(B)
+    R_JUMP,                // continue at instruction A
+    R_JUMP_IF_FALSE,       // continue at instruction A if RK(B) is falsey
+    R_JUMP_IF_NOT_LESS,    // continue at instruction A unless RK(B) < RK(C)
+    R_JUMP_IF_NOT_GREATER, // continue at instruction A unless RK(B) > RK(C)
+    R_CALL,                // call register A with the B arguments in the registers after it, the result lands in A
+    R_RETURN,              // return RK(B)
+};
+
+struct RegInstruction
+{
+    uint8_t op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+};
+
+/**
+
+    @brief The register form of one function's code. Registers are the slots of the function's frame, so register 0 is
+    the callee, the parameters and locals follow it and the rest hold temporaries, exactly where the stack code keeps
+    them. Calls therefore pass arguments the same way in both forms.
+    */
+class RegisterCode
+{
+public:
+    std::vector<RegInstruction> code;
+    std::vector<int> lines; // source line per instruction
+
+    void disassemble(const char *name, ValueArray &constants);
+};
+
+/**
+
+    @brief Translates a function's finished stack bytecode into RegisterCode, so the register VM shares the lexer,
+    parser, compiler and optimizer with the stack VM. The translator runs the stack code symbolically: a push of a
+    local or a constant only records where the value lives, and the instruction consuming it reads it from there
+    directly (GET_LOCAL a; GET_LOCAL b; ADD becomes one ADD t, a, b). A value is only copied into its own register
+    when that is where it has to be: call arguments, locals about to be overwritten, and at jumps and jump targets,
+    where every path has to agree on the register contents.
+    */
+class RegisterTranslator
+{
+public:
+    ObjFunction *function;
+    std::shared_ptr<RegisterCode> output;
+
+    RegisterTranslator(ObjFunction *function);
+
+    bool translate();
+
+private:
+    std::vector<uint16_t> stack; // RK operand holding the value of each stack position
+    int lastWrite = -1;          // instruction whose destination is the top of the stack and may be retargeted
+    int line = 0;
+
+    int emit(uint8_t op, uint16_t a, uint16_t b, uint16_t c);
+
+    void materialize(int position);
+
+    void materializeAll();
+
+    void materializeAliases(uint16_t reg);
+
+    uint16_t pop();
+
+    void pushTemporary();
+
+    void setLocal(uint16_t slot, uint16_t value);
+};
+
+#endif
\ No newline at end of file
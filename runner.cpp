@@ -0,0 +1,175 @@
+#include "runner.hh"
+#include <atomic>
+#include <thread>
+
+#ifdef MAPPED_SOURCES
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SourceFile::SourceFile(const char *path)
+{
+    this->source = NULL;
+    this->size = 0;
+#ifdef MAPPED_SOURCES
+    if (map(path))
+        return;
+#endif
+    read(path);
+}
+
+SourceFile::~SourceFile()
+{
+#ifdef MAPPED_SOURCES
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mappingSize);
+        return;
+    }
+#endif
+    free((void *)source);
+}
+
+#ifdef MAPPED_SOURCES
+/*
+Reserves the file's size plus one byte worth of zeroed pages and maps the file over the start of them. Past the end of
+the file a page is zero filled by the kernel and the reserved pages stay zero, so there is always a terminator.
+*/
+bool SourceFile::map(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t fileSize = (size_t)info.st_size;
+    size_t reserved = (fileSize + 1 + pageSize - 1) / pageSize * pageSize;
+
+    void *memory = mmap(NULL, reserved, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    if (fileSize > 0 && mmap(memory, fileSize, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(memory, reserved);
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    this->mapping = memory;
+    this->mappingSize = reserved;
+    this->source = (const char *)memory;
+    this->size = fileSize;
+    return true;
+}
+#endif
+
+// Reads the whole file into a null terminated buffer, a piece at a time so it also works for files without a size
+bool SourceFile::read(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+
+    std::vector<char> buffer;
+    char piece[4096];
+    size_t bytesRead;
+    while ((bytesRead = fread(piece, sizeof(char), sizeof(piece), file)) > 0)
+    {
+        buffer.insert(buffer.end(), piece, piece + bytesRead);
+    }
+    bool failed = ferror(file);
+    fclose(file);
+    if (failed)
+        return false;
+
+    char *copy = (char *)malloc(buffer.size() + 1);
+    memcpy(copy, buffer.data(), buffer.size());
+    copy[buffer.size()] = '\0';
+
+    this->source = copy;
+    this->size = buffer.size();
+    return true;
+}
+
+ScriptRunner::ScriptRunner(int threadCount)
+{
+    this->threadCount = threadCount < 1 ? 1 : threadCount;
+}
+
+// Runs one script on a VM of its own, the VM is on the heap as it is too large for a worker thread's stack to be safe
+InterpretResult ScriptRunner::runScript(const std::string &path)
+{
+    SourceFile file(path.c_str());
+    if (file.source == NULL)
+    {
+        fprintf(stderr, "Could not open file \"%s\".\n", path.c_str());
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    std::unique_ptr<VM> vm = std::make_unique<VM>();
+    vm->traceExecution = traceExecution;
+    vm->printCode = printCode;
+    vm->useCache = useCache;
+    vm->profileOpcodes = profileOpcodes;
+    vm->registerVM = registerVM;
+    vm->jit = jit;
+    vm->tiering = tiering;
+    vm->hotLoopThreshold = hotLoopThreshold;
+    vm->hotCallThreshold = hotCallThreshold;
+
+    InterpretResult result = vm->interpretFile(path.c_str(), file.source);
+    if (profileOpcodes)
+        vm->printOpcodeProfile();
+    return result;
+}
+
+/**
+
+    @brief Runs every script and waits for all of them to finish.
+    @param paths The scripts to run, a path may appear more than once.
+    @return The result of each script, in the same order as paths.
+    */
+std::vector<InterpretResult> ScriptRunner::runAll(const std::vector<std::string> &paths)
+{
+    std::vector<InterpretResult> results(paths.size(), INTERPRET_OK);
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < paths.size(); i = next++)
+        {
+            results[i] = runScript(paths[i]);
+        }
+    };
+
+    int workers = std::min((size_t)threadCount, paths.size());
+    std::vector<std::thread> threads;
+    for (int i = 1; i < workers; i++)
+    {
+        threads.emplace_back(worker);
+    }
+
+    // the calling thread is one of the workers
+    worker();
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    return results;
+}
\ No newline at end of file
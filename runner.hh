@@ -0,0 +1,66 @@
+#ifndef simpl_runner_h
+#define simpl_runner_h
+
+#include "common.hh"
+#include "vm.hh"
+
+/**
+
+    @brief This class runs a batch of scripts concurrently on a fixed pool of threads. Every script gets its own VM, and
+    with it its own heap, intern table, globals and compiler, so the threads share nothing mutable: a worker just takes
+    the next unclaimed script off a shared counter. Output of scripts running at the same time may interleave.
+    */
+class ScriptRunner
+{
+public:
+    int threadCount;
+
+    // copied onto the VM of every script
+    bool traceExecution = false;
+    bool printCode = false;
+    bool useCache = true;
+    bool profileOpcodes = false;
+    bool registerVM = false;
+    bool jit = false;
+    bool tiering = true;
+    int hotLoopThreshold = HOT_LOOP_THRESHOLD;
+    int hotCallThreshold = HOT_CALL_THRESHOLD;
+
+    ScriptRunner(int threadCount);
+
+    std::vector<InterpretResult> runAll(const std::vector<std::string> &paths);
+
+    InterpretResult runScript(const std::string &path);
+};
+
+/**
+
+    @brief A script's source, null terminated like the Lexer expects. Where the platform has mmap the file is mapped
+    read-only instead of being copied: the mapping is followed by at least one zero byte (the rest of the file's last
+    page, or an extra page when the file fills its last page exactly), so the Lexer finds its terminator without the
+    file ever being written to a buffer. Elsewhere the file is read into a buffer as before.
+    */
+class SourceFile
+{
+public:
+    const char *source; // NULL if the file could not be opened or read
+    size_t size;
+
+    SourceFile(const char *path);
+
+    ~SourceFile();
+
+    SourceFile(const SourceFile &) = delete;
+
+    SourceFile &operator=(const SourceFile &) = delete;
+
+private:
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+
+    bool map(const char *path);
+
+    bool read(const char *path);
+};
+
+#endif
\ No newline at end of file
@@ -1,53 +1,181 @@
 #include <stdlib.h>
 #include <string.h>
 #include "table.hh"
+#include "memory.hh"
 
 
+// Returns the slot holding key, or the slot it should be inserted into (the first tombstone passed, if any)
 template <typename key, typename value, typename hashFunction, typename equalityFunction>
-bool Table<key, value, hashFunction, equalityFunction>::tableSet(key _key, value _value)
+Entry<key, value> *Table<key, value, hashFunction, equalityFunction>::findEntry(std::vector<Entry<key, value>> &entries, key _key)
 {
-    bool exists = false;
+    uint32_t mask = entries.size() - 1;
+    uint32_t index = (uint32_t)hashFunction()(_key) & mask;
+    Entry<key, value> *tombstone = nullptr;
+
+    for (;;)
+    {
+        Entry<key, value> *entry = &entries[index];
+        if (entry->_key == nullptr)
+        {
+            if (!entry->tombstone)
+                return tombstone != nullptr ? tombstone : entry;
+
+            if (tombstone == nullptr)
+                tombstone = entry;
+        }
+        else if (equalityFunction()(entry->_key, _key))
+        {
+            return entry;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+// Rehashes every live entry into a fresh array, tombstones are dropped on the way
+template <typename key, typename value, typename hashFunction, typename equalityFunction>
+void Table<key, value, hashFunction, equalityFunction>::adjustCapacity(int capacity)
+{
+    std::vector<Entry<key, value>> resized(capacity);
+
+    count = 0;
+    for (Entry<key, value> &entry : entries)
+    {
+        if (entry._key == nullptr)
+            continue;
+
+        Entry<key, value> *dest = findEntry(resized, entry._key);
+        dest->_key = entry._key;
+        dest->_value = entry._value;
+        count++;
+    }
+
+    entries = std::move(resized);
+}
 
-    if (!tableFind(_key))
+// returns true if the key was not already in the table
+template <typename key, typename value, typename hashFunction, typename equalityFunction>
+bool Table<key, value, hashFunction, equalityFunction>::tableSet(key _key, value _value)
+{
+    if (count + 1 > capacity() * TABLE_MAX_LOAD)
     {
-        exists = true;
+        adjustCapacity(capacity() < 8 ? 8 : capacity() * 2);
     }
 
-    table[_key] = _value;
-    return exists;
+    Entry<key, value> *entry = findEntry(entries, _key);
+    bool isNewKey = entry->_key == nullptr;
+
+    // reusing a tombstone does not change the load
+    if (isNewKey && !entry->tombstone)
+        count++;
+
+    entry->_key = _key;
+    entry->_value = _value;
+    entry->tombstone = false;
+    return isNewKey;
 }
 
 // returns false if table empty/key not in table, otherwise caller gets the value stored in value ptr
 template <typename key, typename value, typename hashFunction, typename equalityFunction>
 bool Table<key, value, hashFunction, equalityFunction>::tableGet(key _key, value& _value)
 {
-    if (table.find(_key) == table.end())
-    {
+    if (count == 0)
         return false;
-    }
 
-    _value = table.at(_key);
+    Entry<key, value> *entry = findEntry(entries, _key);
+    if (entry->_key == nullptr)
+        return false;
+
+    _value = entry->_value;
     return true;
 }
 
+// leaves a tombstone behind so probe sequences running through this slot keep going
 template <typename key, typename value, typename hashFunction, typename equalityFunction>
 bool Table<key, value, hashFunction, equalityFunction>::tableDelete(key _key)
 {
-    if (table.find(_key) == table.end())
+    if (count == 0)
         return false;
 
-    table.erase(_key);
+    Entry<key, value> *entry = findEntry(entries, _key);
+    if (entry->_key == nullptr)
+        return false;
+
+    entry->_key = nullptr;
+    entry->tombstone = true;
     return true;
 }
   
 template <typename key, typename value, typename hashFunction, typename equalityFunction>
-void Table<key, value, hashFunction, equalityFunction>::tableAddAll(Table from)
+void Table<key, value, hashFunction, equalityFunction>::tableAddAll(Table &from)
 {
-    // 
+    for (Entry<key, value> &entry : from.entries)
+    {
+        if (entry._key != nullptr)
+            tableSet(entry._key, entry._value);
+    }
 }
 
 template <typename key, typename value, typename hashFunction, typename equalityFunction>
 key Table<key, value, hashFunction, equalityFunction>::tableFind(key _search)
 {
-    return table.find(_search) != table.end() ? _search : nullptr;
+    if (count == 0)
+        return nullptr;
+
+    return findEntry(entries, _search)->_key;
+}
+
+// Looks a string up by its characters rather than by identity, this is how makeString finds interned strings
+template <typename key, typename value, typename hashFunction, typename equalityFunction>
+key Table<key, value, hashFunction, equalityFunction>::tableFindString(const char *chars, int length, uint32_t hash)
+{
+    if (count == 0)
+        return nullptr;
+
+    uint32_t mask = capacity() - 1;
+    uint32_t index = hash & mask;
+
+    for (;;)
+    {
+        Entry<key, value> *entry = &entries[index];
+        if (entry->_key == nullptr)
+        {
+            if (!entry->tombstone)
+                return nullptr;
+        }
+        else if (entry->_key->hash == hash && (int)entry->_key->length == length &&
+                 memcmp(entry->_key->chars, chars, length) == 0)
+        {
+            return entry->_key;
+        }
+
+        index = (index + 1) & mask;
+    }
 }
+
+template <typename key, typename value, typename hashFunction, typename equalityFunction>
+void Table<key, value, hashFunction, equalityFunction>::markTable(VM &vm)
+{
+    for (Entry<key, value> &entry : entries)
+    {
+        if (entry._key == nullptr)
+            continue;
+
+        markObject(vm, entry._key);
+        markValue(vm, entry._value);
+    }
+}
+
+// Drops entries whose key was not reached during marking, used to keep the intern table weak
+template <typename key, typename value, typename hashFunction, typename equalityFunction>
+void Table<key, value, hashFunction, equalityFunction>::tableRemoveWhite()
+{
+    for (Entry<key, value> &entry : entries)
+    {
+        if (entry._key != nullptr && !entry._key->isMarked)
+        {
+            entry._key = nullptr;
+            entry.tombstone = true;
+        }
+    }
+}
\ No newline at end of file
@@ -3,16 +3,41 @@
 
 #include "values.hh"
 
+class VM;
+
+// Grow the table once more than 3/4 of the slots are filled (live entries and tombstones)
+#define TABLE_MAX_LOAD 0.75
+
+/**
+
+    @brief A single slot of a Table. An empty slot has no key, a tombstone is an empty slot that used to hold an entry
+    and must not stop a probe sequence.
+    */
+template <typename key, typename value>
+class Entry
+{
+public:
+    key _key = nullptr;
+    value _value;
+    bool tombstone = false;
+};
+
+/**
+
+    @brief Open addressing hash table with linear probing. Entries are stored inline in a single array whose capacity is
+    always a power of two so a hash can be reduced to a slot with a mask. Keys are pointers, hashFunction should be cheap
+    (the string tables use the hash cached on ObjString) and equalityFunction decides when two keys are the same entry.
+    */
 template <typename key, typename value, typename hashFunction, typename equalityFunction>
 class Table
 {
 public:
-    std::unordered_map<key, value, hashFunction, equalityFunction> table;
+    int count = 0; // live entries plus tombstones
+    std::vector<Entry<key, value>> entries;
+
+    Table() {}
 
-    Table()
-    {
-        table = std::unordered_map<key, value, hashFunction, equalityFunction>();
-    }
+    int capacity() { return (int)entries.size(); }
 
     bool tableSet(key _key, value _value);
 
@@ -20,9 +45,20 @@ public:
 
     bool tableDelete(key _key);
 
-    void tableAddAll(Table from);
+    void tableAddAll(Table &from);
 
     key tableFind(key _search);
+
+    key tableFindString(const char *chars, int length, uint32_t hash);
+
+    void markTable(VM &vm);
+
+    void tableRemoveWhite();
+
+private:
+    Entry<key, value> *findEntry(std::vector<Entry<key, value>> &entries, key _key);
+
+    void adjustCapacity(int capacity);
 };
 
 #endif
\ No newline at end of file
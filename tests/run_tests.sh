@@ -0,0 +1,157 @@
+#!/bin/sh
+# Runs every tests/*.simpl on each execution tier and compares what it prints with the .out file next to it.
+#
+# Build the interpreter from the repository root first:
+#     g++ -std=c++17 -O2 -pthread *.cpp -o simpl
+# and again with -DDEBUG_STRESS_GC added, which collects before every allocation, to catch values the collector misses.
+#
+# Usage: tests/run_tests.sh [path to simpl]
+
+SIMPL=${1:-./simpl}
+DIR=$(dirname "$0")
+
+# one line per tier, the flags it is run with; an empty line is the default, tiering up hot code as it goes, and the
+# low thresholds move code to native code after its first pass so a run mixes both tiers
+TIERS="
+--no-tiering
+--jit
+--register-vm
+--hot-loop 1 --hot-call 1
+--hot-loop 2 --hot-call 3"
+
+failed=0
+for script in "$DIR"/*.simpl; do
+    expected="${script%.simpl}.out"
+    echo "$TIERS" | while read -r flags; do
+        # flags is unquoted on purpose, a tier may need more than one
+        if ! "$SIMPL" --no-cache $flags "$script" 2>&1 | cmp -s - "$expected"; then
+            echo "FAIL $script ($flags)"
+            exit 1
+        fi
+    done || failed=1
+done
+
+# a polymorphic add has to settle on the generic form: only the first run of an add site goes through OP_ADD, one that
+# is rewritten back and forth goes through it again every time its operands change kind
+if "$SIMPL" --no-cache --profile-opcodes "$DIR/polymorphic_add.simpl" 2>&1 >/dev/null |
+    awk '$NF == "OP_ADD" && $1 > 10 { thrash = 1 } END { exit !thrash }'; then
+    echo "FAIL $DIR/polymorphic_add.simpl (an add site keeps being requickened)"
+    failed=1
+fi
+
+# the REPL compiles each line on its own, so register code calls functions from earlier lines that were never translated;
+# its prompts are dropped and the error, whose lines differ there, left out
+repl=$(sed '/fails/d' "$DIR/register_fallback.simpl" | "$SIMPL" --register-vm 2>&1 | sed 's/> //g' | grep .)
+if [ "$repl" != "$(grep -v -e '^\[line' -e '^Operands' "$DIR/register_fallback.out")" ]; then
+    echo "FAIL $DIR/register_fallback.simpl (REPL --register-vm)"
+    failed=1
+fi
+
+# The bytecode cache. A script is run cold, compiling it and writing its .simplc, then warm, loading it. Then it is run
+# once per way its cache file can be damaged: each must be rejected, so the script is compiled again and prints the same,
+# which also writes the cold run's cache file back. The damage goes past the checksum by rewriting it, except for the
+# damage the checksum is there to catch; see bytecache.hh for the layout of the file.
+CACHE_DIR=$(mktemp -d)
+SCRIPT="$CACHE_DIR/cached.simpl"
+CACHE="${SCRIPT}c"
+EXPECTED="$DIR/and_or.out"
+cp "$DIR/and_or.simpl" "$SCRIPT"
+
+# the unsigned 32 bit number at a byte offset of the cache, in the machine's byte order like the cache itself
+u32() { od -An -tu4 -j "$1" -N4 "$CACHE" | tr -d ' '; }
+
+# writes the byte value $2 at offset $1 of the cache
+poke() { printf "\\$(printf %o "$2")" | dd of="$CACHE" bs=1 seek="$1" conv=notrunc 2>/dev/null; }
+
+# recomputes the 64 bit FNV-1a checksum at the end of the cache, shell arithmetic wraps around like uint64_t does
+resign() {
+    body=$(($(wc -c < "$CACHE") - 8))
+    hash=-3750763034362895579 # the FNV offset basis as a signed number
+    for byte in $(head -c "$body" "$CACHE" | od -An -v -tu1); do
+        hash=$(((hash ^ byte) * 1099511628211))
+    done
+    head -c "$body" "$CACHE" > "$CACHE.body"
+    mv "$CACHE.body" "$CACHE"
+    i=0
+    while [ $i -lt 8 ]; do
+        printf "\\$(printf %o $(((hash >> (8 * i)) & 255)))" >> "$CACHE"
+        i=$((i + 1))
+    done
+}
+
+# The offset of the run count in the script's line table, the last thing before the checksum: the run count r such that
+# r (line, count) pairs follow it up to the checksum and their counts add up to the byte count in front of the code.
+lineTable() {
+    end=$(($(wc -c < "$CACHE") - 8))
+    runs=1
+    while [ $((end - 4 - 8 * runs)) -gt 0 ]; do
+        table=$((end - 4 - 8 * runs))
+        if [ "$(u32 $table)" = $runs ]; then
+            total=0
+            i=0
+            while [ $i -lt $runs ]; do
+                total=$((total + $(u32 $((table + 8 + 8 * i)))))
+                i=$((i + 1))
+            done
+            if [ "$(u32 $((table - 4 - total)))" = $total ]; then
+                echo $table
+                return
+            fi
+        fi
+        runs=$((runs + 1))
+    done
+}
+
+cacheRun() {
+    if ! "$SIMPL" "$@" "$SCRIPT" 2>&1 | cmp -s - "$EXPECTED"; then
+        echo "FAIL $DIR/and_or.simpl ($CASE)"
+        failed=1
+    fi
+}
+
+CASE="cold cache"
+cacheRun
+cp "$CACHE" "$CACHE_DIR/good"
+
+# a cache that is loaded is left alone, any other run renames a newly written file over it
+CASE="warm cache"
+inode=$(ls -i "$CACHE")
+cacheRun
+if [ "$(ls -i "$CACHE")" != "$inode" ]; then
+    echo "FAIL $DIR/and_or.simpl (the warm run did not load the cache)"
+    failed=1
+fi
+
+for CASE in "wrong version" "bad checksum" "bytecode that fails verification" "truncated file"; do
+    cp "$CACHE_DIR/good" "$CACHE"
+    case $CASE in
+    "wrong version")
+        poke 8 $(($(u32 8) + 1 & 255))
+        resign
+        ;;
+    "bad checksum")
+        middle=$(($(wc -c < "$CACHE") / 2))
+        poke $middle $(($(od -An -tu1 -j $middle -N1 "$CACHE") ^ 1))
+        ;;
+    "bytecode that fails verification")
+        # the script ends in OP_NIL, OP_RETURN: turning the return into a second OP_NIL runs off the end of the code
+        table=$(lineTable)
+        poke $((table - 1)) $(od -An -tu1 -j $((table - 2)) -N1 "$CACHE")
+        resign
+        ;;
+    "truncated file")
+        head -c $(($(wc -c < "$CACHE") / 2)) "$CACHE" > "$CACHE.half"
+        mv "$CACHE.half" "$CACHE"
+        resign
+        ;;
+    esac
+    cacheRun
+    if ! cmp -s "$CACHE" "$CACHE_DIR/good"; then
+        echo "FAIL $DIR/and_or.simpl (the cache with $CASE was not replaced)"
+        failed=1
+    fi
+done
+rm -rf "$CACHE_DIR"
+
+[ $failed = 0 ] && echo "all tests passed"
+exit $failed
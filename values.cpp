@@ -14,6 +14,16 @@ int ValueArray::size()
 
 void printValue(Value value)
 {
+#ifdef NAN_BOXING
+    if (IS_BOOL(value))
+        printf(AS_BOOL(value) ? "true" : "false");
+    else if (IS_NIL(value))
+        printf("nil");
+    else if (IS_NUMBER(value))
+        printf("%g", AS_NUMBER(value));
+    else if (IS_OBJ(value))
+        printObject(value);
+#else
     switch (value.type)
     {
     case VAL_BOOL:
@@ -29,17 +39,27 @@ void printValue(Value value)
         printObject(value);
         break;
     }
+#endif
 }
 
-bool valuesEqual(Value a, Value b)
+bool valuesEqual(VM &vm, Value a, Value b)
 {
+#ifdef NAN_BOXING
+    // numbers are compared as doubles so NaN != NaN, everything else is identical iff the bits are
+    if (IS_NUMBER(a) && IS_NUMBER(b)) return AS_NUMBER(a) == AS_NUMBER(b);
+    if (IS_STRING(a) && IS_STRING(b)) return stringsEqual(vm, AS_STRING(a), AS_STRING(b));
+    return a == b;
+#else
     if (a.type != b.type) return false;
     switch (a.type)
     {
         case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL:    return true;
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_OBJ:
+            if (IS_STRING(a) && IS_STRING(b)) return stringsEqual(vm, AS_STRING(a), AS_STRING(b));
+            return AS_OBJ(a) == AS_OBJ(b);
         default:         return false; // unreachable
     }
+#endif
 }
\ No newline at end of file
@@ -4,6 +4,61 @@
 #include "common.hh"
 
 class Obj;
+class VM;
+
+#ifdef NAN_BOXING
+
+/*
+8 byte values: a double is stored as itself, every other value hides inside the unused bits of a quiet NaN.
+- Numbers: any bit pattern that is not a quiet NaN with all of the QNAN bits set
+- nil/true/false: QNAN with a small tag in the lowest bits
+- Objects: QNAN with the sign bit set, the pointer lives in the lower 48 bits
+*/
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL 1   // 01
+#define TAG_FALSE 2 // 10
+#define TAG_TRUE 3  // 11
+
+typedef uint64_t Value;
+
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+// Check if a Value type has a specific C type
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value) ((value) == NIL_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+// converts Value types into C values
+#define AS_OBJ(value) ((Obj *)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) valueToNum(value)
+
+// converts C values into Value type -> allows dynamic typing
+#define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define NUMBER_VAL(num) numToValue(num)
+#define OBJ_VAL(obj) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+static inline double valueToNum(Value value)
+{
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+static inline Value numToValue(double num)
+{
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+#else
 
 enum ValueType
 {
@@ -18,7 +73,7 @@ struct Value
 {
     ValueType type;
 
-    std::variant<bool, double, std::shared_ptr<Obj>> val;
+    std::variant<bool, double, Obj *> val;
 };
 
 // Check if a Value type has a specific C type
@@ -28,15 +83,36 @@ struct Value
 #define IS_OBJ(value)   ((value).type == VAL_OBJ)
 
 // converts Value types into C values
-#define AS_OBJ(value)   ((std::get<std::shared_ptr<Obj>>(value.val)))
-#define AS_BOOL(value) ((std::get<bool>(value.val)))
-#define AS_NUMBER(value) ((std::get<double>(value.val)))
+#define AS_OBJ(value)   ((std::get<Obj *>((value).val)))
+#define AS_BOOL(value) ((std::get<bool>((value).val)))
+#define AS_NUMBER(value) ((std::get<double>((value).val)))
 
 // converts C values into Value type -> allows dynamic typing
-#define BOOL_VAL(value) ((Value){VAL_BOOL, value})
+#define BOOL_VAL(value) ((Value){VAL_BOOL, (bool)(value)})
 #define NIL_VAL ((Value){VAL_NIL, 0.0})
-#define NUMBER_VAL(value) ((Value){VAL_NUMBER, value})
-#define OBJ_VAL(object) ((Value){VAL_OBJ, object})
+#define NUMBER_VAL(value) ((Value){VAL_NUMBER, (double)(value)})
+#define OBJ_VAL(object) ((Value){VAL_OBJ, (Obj *)(object)})
+
+#endif
+
+/*
+When both operands of an arithmetic instruction are NaNs, x86 passes on the one in its first operand, so which NaN (and
+with it the sign print shows) comes out depends on the operand order the C++ compiler or the JIT picked. Every NaN
+an arithmetic instruction produces is replaced by this one instead, so all tiers and constant folding agree.
+*/
+#define CANONICAL_NAN_BITS ((uint64_t)0x7ff8000000000000)
+
+static inline double canonicalNumber(double num)
+{
+    if (num == num)
+        return num;
+    uint64_t bits = CANONICAL_NAN_BITS;
+    memcpy(&num, &bits, sizeof(num));
+    return num;
+}
+
+// The Value of an arithmetic result, see canonicalNumber()
+#define ARITHMETIC_VAL(num) NUMBER_VAL(canonicalNumber(num))
 
 
 class ValueArray
@@ -56,6 +132,7 @@ public:
 
 void printValue(Value value);
 
-bool valuesEqual(Value a, Value b);
+// vm owns the strings compared, comparing a rope flattens it
+bool valuesEqual(VM &vm, Value a, Value b);
 
 #endif
\ No newline at end of file
@@ -3,8 +3,14 @@
 #include "vm.hh"
 #include "debug.hh"
 #include "bytecodes.hh"
+#include "memory.hh"
+#include "bytecache.hh"
+#include "jit.hh"
 #include "table.cpp"
 
+// The table definitions only live in this translation unit so the instantiation other files link against is made here
+template class Table<ObjString *, Value, Hashing, Equality>;
+
 
 /* 
 Every operation has a number associated with it in terms of how it modifies the stack i.e.:
@@ -15,19 +21,41 @@ Adding a sequence of instructions gives the total effect on the stack:
 - Statement: zero because a statement does not push any values onto the stack after execution
 */
 
-size_t Hashing::operator()(const std::shared_ptr<ObjString> obj) const
+size_t Hashing::operator()(ObjString *obj) const
 {
-        return std::hash<std::string>{}(obj->str);
+    return obj->hash;
 }
 
 VM::VM()
 {
     resetStack();
+    this->objects = NULL;
+    this->bytesAllocated = 0;
+    this->nextGC = GC_INITIAL_THRESHOLD;
+    this->gcGrowFactor = GC_HEAP_GROW_FACTOR;
+}
+
+VM::~VM()
+{
+    freeObjects();
 }
 
 void VM::resetStack()
 {
     this->stackTop = this->stack;
+    this->frameCount = 0;
+}
+
+// Walks the intrusive object list and releases every heap object the VM has allocated
+void VM::freeObjects()
+{
+    Obj *object = this->objects;
+    while (object != NULL)
+    {
+        Obj *next = object->next;
+        freeObject(*this, object);
+        object = next;
+    }
     this->objects = NULL;
 }
 
@@ -39,34 +67,53 @@ void VM::runtimeError(const char *format, ...)
     va_end(args);
     fputs("\n", stderr);
 
-    // Get line/chunk that caused error for debugging
-    size_t instruction = *(this->ip - this->bytearray->bytes.size() - 1);
-    int line = this->bytearray->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
+    // stack trace, innermost call first; each frame's ip is already past the instruction it was running
+    for (int i = frameCount - 1; i >= 0; i--)
+    {
+        CallFrame *frame = &frames[i];
+        ObjFunction *function = frame->function;
+        int line;
+        if (frame->registerIp != NULL)
+            line = function->registers->lines[frame->registerIp - function->registers->code.data() - 1];
+        else
+            line = function->chunk->lines[frame->ip - function->chunk->bytes.data() - 1];
+        fprintf(stderr, "[line %d] in ", line);
+        if (function->name == NULL)
+            fprintf(stderr, "script\n");
+        else
+            fprintf(stderr, "%s()\n", function->name->chars);
+    }
     resetStack();
 }
 
-// Reads and executes bytes
-InterpretResult VM::run()
+// Returns the slot for a global name, giving the name a new undefined slot the first time it is seen
+int VM::globalSlot(ObjString *name)
 {
-#define READ_BYTE() ((this->ip)++)
-#define READ_CONSTANT() (this->bytearray->constants.values[*READ_BYTE()])
-#define READ_SHORT() (this->ip += 2, (uint16_t)((this->ip[-2] << 8 | this->ip[-1])))
-#define READ_STRING() AS_STRING(READ_CONSTANT())
-#define BINARY_OP(valueType, op)                        \
-    do                                                  \
-    {                                                   \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) \
-        {                                               \
-            runtimeError("Operands must be numbers.");  \
-            return INTERPRET_RUNTIME_ERROR;             \
-        }                                               \
-        double b = AS_NUMBER(pop());                    \
-        double a = AS_NUMBER(pop());                    \
-        push(valueType(a op b));                        \
-    } while (false)
+    Value index;
+    if (globalNames.tableGet(name, index))
+        return (int)AS_NUMBER(index);
+
+    globals.push_back(Global{NIL_VAL, name, false});
+    globalNames.tableSet(name, NUMBER_VAL(globals.size() - 1));
+    return globals.size() - 1;
+}
+
+// Runs before every instruction in the instrumented loop: prints the stack followed by the instruction about to be
+// executed (--trace) and/or counts it in the opcode pair histogram (--profile-opcodes)
+void VM::instrumentInstruction(CallFrame *frame)
+{
+    if (profileOpcodes)
+    {
+        if (opcodePairs.empty())
+            opcodePairs.assign(256 * 256, 0);
+        if (previousOpcode != -1)
+            opcodePairs[previousOpcode * 256 + *frame->ip]++;
+        previousOpcode = *frame->ip;
+    }
+
+    if (!traceExecution)
+        return;
 
-#ifdef DEBUG_TRACE_EXECUTION
     printf("          ");
     for (Value *slot = this->stack; slot < this->stackTop; slot++)
     {
@@ -75,210 +122,709 @@ InterpretResult VM::run()
         printf(" ]");
     }
     printf("\n");
-    // disassembleInstruction(this->chunk, int(this->ip - this->bytearray->bytes));
+    std::shared_ptr<ByteArray> chunk = frame->function->chunk;
+    Disassembler(chunk, "").disassembleInstruction(int(frame->ip - chunk->bytes.data()));
+}
+
+// Prints the most frequent opcode pairs counted so far to stderr
+void VM::printOpcodeProfile()
+{
+    std::vector<std::pair<uint64_t, int>> pairs;
+    uint64_t total = 0;
+    for (int i = 0; i < (int)opcodePairs.size(); i++)
+    {
+        if (opcodePairs[i] == 0)
+            continue;
+        pairs.push_back({opcodePairs[i], i});
+        total += opcodePairs[i];
+    }
+    std::sort(pairs.begin(), pairs.end(), std::greater<>());
+
+    fprintf(stderr, "== opcode pairs ==\n");
+    for (size_t i = 0; i < pairs.size() && i < 20; i++)
+    {
+        const char *first = opcodeName(pairs[i].second / 256);
+        const char *second = opcodeName(pairs[i].second % 256);
+        fprintf(stderr, "%12llu %5.1f%%  %s -> %s\n", (unsigned long long)pairs[i].first,
+                100.0 * pairs[i].first / total, first, second);
+    }
+}
+
+/*
+Pushes a frame for function, whose arguments are the top argCount values of the stack with the function itself below
+them. Overflow is checked here once per call: the compiler measured the most slots the function can use, so if they
+all fit nothing inside the call has to check again.
+*/
+bool VM::call(ObjFunction *function, int argCount)
+{
+    if (argCount != function->arity)
+    {
+        runtimeError("Expected %d arguments but got %d.", function->arity, argCount);
+        return false;
+    }
+
+    Value *slots = stackTop - argCount - 1;
+    if (frameCount == FRAMES_MAX || slots + function->maxStack > stack + STACK_MAX)
+    {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    CallFrame *frame = &frames[frameCount++];
+    frame->function = function;
+    frame->ip = function->chunk->bytes.data();
+    frame->registerIp = runningRegisters ? function->registers->code.data() : NULL;
+    frame->slots = slots;
+    return true;
+}
+
+bool VM::callValue(Value callee, int argCount)
+{
+    if (IS_FUNCTION(callee))
+        return call(AS_FUNCTION(callee), argCount);
+
+    runtimeError("Can only call functions.");
+    return false;
+}
+
+// Reads and executes bytes, the instrumented loop is a separate instantiation so the normal one carries no checks for
+// tracing or profiling
+InterpretResult VM::run()
+{
+    return traceExecution || profileOpcodes ? execute<true>() : execute<false>();
+}
+
+template <bool Instrumented>
+InterpretResult VM::execute()
+{
+/*
+The state every instruction touches is kept in locals so the compiler can hold it in registers instead of going
+through this, the frame and the chunk's shared_ptr each time:
+- ip points at the next byte of the running function's code
+- sp is the stack top
+- slots and constants are the running frame's locals and its function's constant pool
+
+They are written back to the frame and stackTop (STORE_FRAME) only before something else looks at them: calls, runtime
+errors, allocations (the collector scans the stack) and tracing. LOAD_FRAME picks them up again from the frame on top.
+*/
+    CallFrame *frame;
+    uint8_t *ip;
+    Value *sp = stackTop;
+    Value *slots;
+    Value *constants;
+
+#define LOAD_FRAME()                                                 \
+    do                                                               \
+    {                                                                \
+        frame = &frames[frameCount - 1];                             \
+        ip = frame->ip;                                              \
+        slots = frame->slots;                                        \
+        constants = frame->function->chunk->constants.values.data(); \
+    } while (false)
+#define STORE_FRAME()       \
+    do                      \
+    {                       \
+        frame->ip = ip;     \
+        stackTop = sp;      \
+    } while (false)
+
+#define READ_BYTE() (*ip++)
+#define READ_CONSTANT() (constants[READ_BYTE()])
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8 | ip[-1])))
+#define READ_STRING() AS_STRING(READ_CONSTANT())
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define PEEK(distance) (sp[-1 - (distance)])
+#define RUNTIME_ERROR(...)               \
+    do                                   \
+    {                                    \
+        STORE_FRAME();                   \
+        runtimeError(__VA_ARGS__);       \
+        return INTERPRET_RUNTIME_ERROR;  \
+    } while (false)
+#define BINARY_OP(valueType, op)                        \
+    do                                                  \
+    {                                                   \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        double b = AS_NUMBER(POP());                    \
+        double a = AS_NUMBER(POP());                    \
+        PUSH(valueType(a op b));                        \
+    } while (false)
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+/*
+Both dispatch strategies share the handler bodies below:
+- CASE(op) opens the handler for an opcode
+- DISPATCH() ends a handler and moves on to the next instruction
+
+With COMPUTED_GOTO every handler ends in its own indirect jump through dispatchTable (threaded code), which gives the
+branch predictor one jump site per opcode instead of the single shared jump of the switch. Otherwise the portable
+switch inside for(;;) is used.
+*/
+#ifdef COMPUTED_GOTO
+    // Must list a label for every opcode in the same order as the OpCode enum
+    static const void *dispatchTable[] = {
+        &&L_OP_CONSTANT,
+        &&L_OP_NIL,
+        &&L_OP_TRUE,
+        &&L_OP_FALSE,
+        &&L_OP_POP,
+        &&L_OP_DEFINE_GLOBAL,
+        &&L_OP_GET_LOCAL,
+        &&L_OP_SET_LOCAL,
+        &&L_OP_GET_GLOBAL,
+        &&L_OP_SET_GLOBAL,
+        &&L_OP_EQUAL,
+        &&L_OP_GREATER,
+        &&L_OP_LESS,
+        &&L_OP_NOT_EQUAL,
+        &&L_OP_GREATER_EQUAL,
+        &&L_OP_LESS_EQUAL,
+        &&L_OP_ADD,
+        &&L_OP_SUBTRACT,
+        &&L_OP_MULTIPLY,
+        &&L_OP_DIVIDE,
+        &&L_OP_NOT,
+        &&L_OP_NEGATE,
+        &&L_OP_CALL,
+        &&L_OP_RETURN,
+        &&L_OP_PRINT,
+        &&L_OP_JUMP,
+        &&L_OP_JUMP_IF_FALSE,
+        &&L_OP_POP_JUMP_IF_FALSE,
+        &&L_OP_LOOP,
+        &&L_OP_GET_LOCAL_2,
+        &&L_OP_ADD_LOCAL_CONSTANT,
+        &&L_OP_LESS_LOCAL_CONSTANT_JUMP,
+        &&L_OP_GREATER_LOCAL_CONSTANT_JUMP,
+        &&L_OP_ADD_NUM_NUM,
+        &&L_OP_ADD_STR_STR,
+        &&L_OP_ADD_GENERIC,
+    };
+    static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == OP_ADD_GENERIC + 1,
+                  "dispatchTable is missing an opcode");
+
+#define CASE(op) L_##op:
+#define DISPATCH()                              \
+    do                                          \
+    {                                           \
+        if constexpr (Instrumented)             \
+        {                                       \
+            STORE_FRAME();                      \
+            instrumentInstruction(frame);       \
+        }                                       \
+        goto *dispatchTable[READ_BYTE()];       \
+    } while (false)
+#else
+#define CASE(op) case op:
+#define DISPATCH() continue
 #endif
 
+    LOAD_FRAME();
+
+#ifdef COMPUTED_GOTO
+    DISPATCH();
+#else
     for (;;)
     {
+        if constexpr (Instrumented)
+        {
+            STORE_FRAME();
+            instrumentInstruction(frame);
+        }
+
         uint8_t instruction;
-        switch (instruction = *READ_BYTE())
+        switch (instruction = READ_BYTE())
+        {
+#endif
+        /*
+        Quickening: the generic add rewrites itself in the chunk into the variant for the operand types it just saw, so
+        from then on a monomorphic add checks its one guard only. A variant whose guard fails writes OP_ADD_GENERIC,
+        which adds whatever it is given and is never rewritten again, and carries on in it without another dispatch: an
+        add that sees numbers and strings in turn settles there instead of being rewritten back and forth on every run.
+        Chunks belong to a single VM and the cache is written before the code runs, so the rewrite never reaches another
+        interpreter.
+        */
+        CASE(OP_ADD)
         {
-        case OP_ADD:
+            if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1)))
+                ip[-1] = OP_ADD_STR_STR;
+            else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+                ip[-1] = OP_ADD_NUM_NUM;
+            goto addGeneric;
+        }
+
+        CASE(OP_ADD_GENERIC)
+        addGeneric:
         {
-            if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
+            if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1)))
             {
-                Value val = concatenate();
-                push(val);
+                // allocating the result may collect, which scans the stack (still holding the operands) up to stackTop
+                STORE_FRAME();
+                Value val = concatenate(AS_STRING(PEEK(1)), AS_STRING(PEEK(0)));
+                sp -= 2;
+                PUSH(val);
             }
-            else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+            else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
             {
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(a + b));
+                double b = AS_NUMBER(POP());
+                double a = AS_NUMBER(POP());
+                PUSH(ARITHMETIC_VAL(a + b));
             }
             else
             {
-                runtimeError("Operands must be two numbers or two strings.");
-                return INTERPRET_RUNTIME_ERROR;
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
             }
-            break;
+            DISPATCH();
         }
-        case OP_SUBTRACT:
+
+        CASE(OP_ADD_NUM_NUM)
         {
-            BINARY_OP(NUMBER_VAL, -);
-            break;
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))
+            {
+                ip[-1] = OP_ADD_GENERIC;
+                goto addGeneric;
+            }
+            double b = AS_NUMBER(POP());
+            PEEK(0) = ARITHMETIC_VAL(AS_NUMBER(PEEK(0)) + b);
+            DISPATCH();
         }
 
-        case OP_MULTIPLY:
+        CASE(OP_ADD_STR_STR)
         {
-            BINARY_OP(NUMBER_VAL, *);
-            break;
+            if (!IS_STRING(PEEK(0)) || !IS_STRING(PEEK(1)))
+            {
+                ip[-1] = OP_ADD_GENERIC;
+                goto addGeneric;
+            }
+            STORE_FRAME();
+            Value val = concatenate(AS_STRING(PEEK(1)), AS_STRING(PEEK(0)));
+            sp--;
+            PEEK(0) = val;
+            DISPATCH();
         }
 
-        case OP_DIVIDE:
+        CASE(OP_SUBTRACT)
         {
-            BINARY_OP(NUMBER_VAL, /);
-            break;
+            BINARY_OP(ARITHMETIC_VAL, -);
+            DISPATCH();
         }
 
-        case OP_NOT:
-            push(BOOL_VAL(isFalsey(pop())));
-            break;
+        CASE(OP_MULTIPLY)
+        {
+            BINARY_OP(ARITHMETIC_VAL, *);
+            DISPATCH();
+        }
+
+        CASE(OP_DIVIDE)
+        {
+            BINARY_OP(ARITHMETIC_VAL, /);
+            DISPATCH();
+        }
+
+        CASE(OP_NOT)
+        {
+            PEEK(0) = BOOL_VAL(isFalsey(PEEK(0)));
+            DISPATCH();
+        }
 
-        case OP_NEGATE:
+        CASE(OP_NEGATE)
         {
             // If value on top of stack is not a number - cant negate therefore runtime error
             // Check that value by using a peek showing the next item of the stack
-            if (!IS_NUMBER(peek(0)))
-            {
-                runtimeError("Operand must be a number.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            push(NUMBER_VAL(-AS_NUMBER(pop())));
-            break;
+            if (!IS_NUMBER(PEEK(0)))
+                RUNTIME_ERROR("Operand must be a number.");
+            PEEK(0) = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
+            DISPATCH();
         }
 
-        case OP_PRINT:
+        CASE(OP_PRINT)
         {
-            printValue(pop());
+            printValue(POP());
             std::cout << '\n';
-            break;
+            DISPATCH();
         }
 
-        case OP_RETURN:
+        CASE(OP_CALL)
         {
-            // Exit interpreter
-            return INTERPRET_OK;
+            int argCount = READ_BYTE();
+            STORE_FRAME();
+            if (!callValue(PEEK(argCount), argCount))
+                return INTERPRET_RUNTIME_ERROR;
+
+            // a callee with native code runs there to its return, and this frame carries on with the result
+            if constexpr (!Instrumented)
+            {
+                ObjFunction *callee = frames[frameCount - 1].function;
+                if (callee->native != nullptr || (tiering && hotCall(callee)))
+                {
+                    if (callee->native->run(*this, 0) != INTERPRET_OK)
+                        return INTERPRET_RUNTIME_ERROR;
+                    sp = stackTop;
+                    DISPATCH();
+                }
+            }
+            LOAD_FRAME();
+            DISPATCH();
         }
 
-        case OP_CONSTANT:
+        CASE(OP_RETURN)
+        {
+            Value result = POP();
+            frameCount--;
+
+            // returning from the script itself exits the interpreter, which also pops the script's function
+            if (frameCount == 0)
+            {
+                stackTop = slots;
+                return INTERPRET_OK;
+            }
+
+            // discard the callee's slots, its arguments and locals, and leave the result in their place
+            sp = slots;
+            PUSH(result);
+
+            // a call made from register or native code, which carries on with the caller itself
+            if (frameCount == returnDepth)
+            {
+                stackTop = sp;
+                return INTERPRET_OK;
+            }
+            LOAD_FRAME();
+            DISPATCH();
+        }
+
+        CASE(OP_CONSTANT)
         {
             Value constant = READ_CONSTANT();
-            this->push(constant);
-            break;
+            PUSH(constant);
+            DISPATCH();
         }
 
-        case OP_NIL:
-            push(NIL_VAL);
-            break;
+        CASE(OP_NIL)
+        {
+            PUSH(NIL_VAL);
+            DISPATCH();
+        }
 
-        case OP_FALSE:
-            push(BOOL_VAL(true));
-            break;
+        CASE(OP_TRUE)
+        {
+            PUSH(BOOL_VAL(true));
+            DISPATCH();
+        }
 
-        case OP_TRUE:
-            push(BOOL_VAL(false));
-            break;
+        CASE(OP_FALSE)
+        {
+            PUSH(BOOL_VAL(false));
+            DISPATCH();
+        }
 
-        case OP_POP:
-            pop();
-            break;
+        CASE(OP_POP)
+        {
+            sp--;
+            DISPATCH();
+        }
 
-        case OP_GET_LOCAL:
+        CASE(OP_GET_LOCAL)
         {
-            uint8_t slot = *READ_BYTE();
-            push(stack[slot]);
-            break;
+            uint8_t slot = READ_BYTE();
+            PUSH(slots[slot]);
+            DISPATCH();
         }
 
-        case OP_SET_LOCAL:
+        CASE(OP_SET_LOCAL)
         {
-            uint8_t slot = *READ_BYTE();
-            stack[slot] = peek(0);
-            break;
+            uint8_t slot = READ_BYTE();
+            slots[slot] = PEEK(0);
+            DISPATCH();
         }
 
-        case OP_DEFINE_GLOBAL:
+        CASE(OP_DEFINE_GLOBAL)
         {
-            std::shared_ptr<ObjString> name = READ_STRING();
-            globals.tableSet(name, peek(0));
-            pop();
-            break;
+            Global &global = globals[READ_SHORT()];
+            global.value = PEEK(0);
+            global.defined = true;
+            sp--;
+            DISPATCH();
         }
 
-        case OP_GET_GLOBAL:
+        CASE(OP_GET_GLOBAL)
         {
-            std::shared_ptr<ObjString> name = READ_STRING();
-            Value value;
-            if (!(globals.tableGet(name, value)))
-            {
-                runtimeError("Undefined variable '%s'.", name->str);
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            push(value);
-            break;
+            Global &global = globals[READ_SHORT()];
+            if (!global.defined)
+                RUNTIME_ERROR("Undefined variable '%s'.", global.name->chars);
+            PUSH(global.value);
+            DISPATCH();
         }
 
-        case OP_SET_GLOBAL:
+        CASE(OP_SET_GLOBAL)
         {
-            std::shared_ptr<ObjString> name = READ_STRING();
-            if (globals.tableSet(name, peek(0)))
-            {
-                globals.tableDelete(name);
-                runtimeError("Undefined variable '%s'", name->str);
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            break;
+            Global &global = globals[READ_SHORT()];
+            if (!global.defined)
+                RUNTIME_ERROR("Undefined variable '%s'", global.name->chars);
+            global.value = PEEK(0);
+            DISPATCH();
         }
 
-        case OP_GREATER:
+        CASE(OP_GREATER)
+        {
             BINARY_OP(BOOL_VAL, >);
-            break;
+            DISPATCH();
+        }
 
-        case OP_LESS:
+        CASE(OP_LESS)
+        {
             BINARY_OP(BOOL_VAL, <);
-            break;
+            DISPATCH();
+        }
+
+        CASE(OP_EQUAL)
+        {
+            Value b = POP();
+            Value a = POP();
+            PUSH(BOOL_VAL(valuesEqual(*this, a, b)));
+            DISPATCH();
+        }
 
-        case OP_EQUAL:
+        CASE(OP_NOT_EQUAL)
         {
-            Value b = pop();
-            Value a = pop();
-            push(BOOL_VAL(valuesEqual(a, b)));
-            break;
+            Value b = POP();
+            Value a = POP();
+            PUSH(BOOL_VAL(!valuesEqual(*this, a, b)));
+            DISPATCH();
         }
 
-        case OP_JUMP_IF_FALSE:
+        // a >= b and a <= b mean !(a < b) and !(a > b), which is not the same thing when an operand is NaN
+        CASE(OP_GREATER_EQUAL)
+        {
+            BINARY_OP(NOT_BOOL_VAL, <);
+            DISPATCH();
+        }
+
+        CASE(OP_LESS_EQUAL)
+        {
+            BINARY_OP(NOT_BOOL_VAL, >);
+            DISPATCH();
+        }
+
+        CASE(OP_JUMP)
+        {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            DISPATCH();
+        }
+
+        CASE(OP_JUMP_IF_FALSE)
+        {
+            uint16_t offset = READ_SHORT();
+            if (isFalsey(PEEK(0))) ip += offset;
+            DISPATCH();
+        }
+
+        CASE(OP_POP_JUMP_IF_FALSE)
         {
             uint16_t offset = READ_SHORT();
-            if (isFalsey(peek(0))) ip += offset;
-            break;
+            if (isFalsey(POP())) ip += offset;
+            DISPATCH();
         }
 
-        case OP_LOOP:
+        CASE(OP_LOOP)
         {
             uint16_t offset = READ_SHORT();
             ip -= offset;
-            break;
+
+            /*
+            On-stack replacement: once the loop is hot the frame carries on in native code from the loop header, with
+            the stack as it is. The native code runs the frame to its return, so the interpreter continues with the
+            caller, unless the frame was the last one this run() was asked to execute.
+            */
+            if constexpr (!Instrumented)
+            {
+                ObjFunction *function = frame->function;
+                int header = (int)(ip - function->chunk->bytes.data());
+                if (tiering && hotLoop(function, header))
+                {
+                    STORE_FRAME();
+                    if (function->native->run(*this, header) != INTERPRET_OK)
+                        return INTERPRET_RUNTIME_ERROR;
+                    if (frameCount == returnDepth)
+                        return INTERPRET_OK;
+                    sp = stackTop;
+                    LOAD_FRAME();
+                }
+            }
+            DISPATCH();
+        }
+
+        CASE(OP_GET_LOCAL_2)
+        {
+            uint8_t first = READ_BYTE();
+            uint8_t second = READ_BYTE();
+            PUSH(slots[first]);
+            PUSH(slots[second]);
+            DISPATCH();
+        }
+
+        // same result as the OP_ADD it replaces, the common number case never touches the stack
+        CASE(OP_ADD_LOCAL_CONSTANT)
+        {
+            Value *local = &slots[READ_BYTE()];
+            Value constant = READ_CONSTANT();
+            if (IS_NUMBER(*local) && IS_NUMBER(constant))
+            {
+                *local = ARITHMETIC_VAL(AS_NUMBER(*local) + AS_NUMBER(constant));
+            }
+            else if (IS_STRING(*local) && IS_STRING(constant))
+            {
+                // both operands stay reachable, one from the frame and the other from the constant pool
+                STORE_FRAME();
+                *local = concatenate(AS_STRING(*local), AS_STRING(constant));
+            }
+            else
+            {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
+            }
+            DISPATCH();
+        }
+
+        CASE(OP_LESS_LOCAL_CONSTANT_JUMP)
+        {
+            Value a = slots[READ_BYTE()];
+            Value b = READ_CONSTANT();
+            uint16_t offset = READ_SHORT();
+            if (!IS_NUMBER(a) || !IS_NUMBER(b))
+                RUNTIME_ERROR("Operands must be numbers.");
+            if (!(AS_NUMBER(a) < AS_NUMBER(b))) ip += offset;
+            DISPATCH();
+        }
+
+        CASE(OP_GREATER_LOCAL_CONSTANT_JUMP)
+        {
+            Value a = slots[READ_BYTE()];
+            Value b = READ_CONSTANT();
+            uint16_t offset = READ_SHORT();
+            if (!IS_NUMBER(a) || !IS_NUMBER(b))
+                RUNTIME_ERROR("Operands must be numbers.");
+            if (!(AS_NUMBER(a) > AS_NUMBER(b))) ip += offset;
+            DISPATCH();
         }
+#ifndef COMPUTED_GOTO
         }
     }
+#endif
 
+#undef LOAD_FRAME
+#undef STORE_FRAME
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef READ_SHORT
 #undef READ_STRING
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef RUNTIME_ERROR
 #undef BINARY_OP
+#undef NOT_BOOL_VAL
+#undef CASE
+#undef DISPATCH
 }
 
-InterpretResult VM::interpret(const char *source)
+// Compiles source into the function for the top level of the script, each function is optimized as it is finished.
+// Returns NULL on a compile error
+ObjFunction *VM::compile(const char *source)
 {
+    Compiler scriptCompiler(this, source);
+    scriptCompiler.printCode = printCode;
 
-    // Chunk to be filled from user input
-    std::shared_ptr<ByteArray> fill = std::make_shared<ByteArray>();
-    compiler = Compiler(source);
+    compiler = &scriptCompiler;
+    ObjFunction *function = scriptCompiler.compile();
+    compiler = nullptr;
+    return function;
+}
 
-    // If compilation fails, return result
-    if (!compiler.compile(fill))
+/*
+Runs a script's top level function from a fresh frame. With --register-vm the script runs on the register VM when its
+top level translates, any function that does not runs on the interpreter when it is called. With --jit it runs as native
+code when all of its functions translate. Tracing and profiling only exist for the interpreter so they keep it.
+*/
+InterpretResult VM::runFunction(ObjFunction *function)
+{
+    bool instrumented = traceExecution || profileOpcodes;
+    if (registerVM && !instrumented)
+        prepareRegisters(function);
+    bool registers = registerVM && !instrumented && function->registers != nullptr;
+    bool native = jit && !registers && !instrumented && prepareNative(function);
+
+    push(OBJ_VAL(function));
+    runningRegisters = registers;
+    bool called = call(function, 0);
+    runningRegisters = false;
+    if (!called)
+        return INTERPRET_RUNTIME_ERROR;
+    if (native)
+        return function->native->run(*this, 0);
+    if (!registers)
+        return run();
+
+    clearRegisters(0);
+    runningRegisters = true;
+    InterpretResult result = executeRegisters();
+    runningRegisters = false;
+    return result;
+}
+
+InterpretResult VM::interpret(const char *source)
+{
+    ObjFunction *function = compile(source);
+    if (function == NULL)
     {
         return INTERPRET_COMPILE_ERROR;
     }
 
-    // otherwise the chunk is run on the virtual machine
-    this->bytearray = fill;
-    this->ip = this->bytearray->bytes.begin();
-    InterpretResult result = run();
+    // otherwise the script is run on the virtual machine
+    return runFunction(function);
+}
 
-    return result;
+// Disassembles a function followed by every function declared inside it
+static void disassembleFunction(ObjFunction *function)
+{
+    std::string title = function->name != NULL ? function->name->chars : "<script>";
+    title += " (cached)";
+    Disassembler(function->chunk, title.c_str()).disassembleByteArray();
+
+    for (Value &constant : function->chunk->constants.values)
+    {
+        if (IS_FUNCTION(constant))
+            disassembleFunction(AS_FUNCTION(constant));
+    }
+}
+
+// Like interpret() but goes through the script's bytecode cache: a cache written for the same source is loaded instead
+// of compiling, otherwise the freshly compiled code is written to the cache for next time
+InterpretResult VM::interpretFile(const char *path, const char *source)
+{
+    if (!useCache)
+        return interpret(source);
+
+    ByteCache cache(this, path, source);
+
+    ObjFunction *function = cache.load();
+    if (function != NULL)
+    {
+        if (printCode)
+            disassembleFunction(function);
+        return runFunction(function);
+    }
+
+    function = compile(source);
+    if (function == NULL)
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    cache.store(function);
+    return runFunction(function);
 }
 
 /*
@@ -307,27 +853,17 @@ bool VM::isFalsey(Value value)
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-Value VM::concatenate()
+// a and b have to be reachable by the collector, making the result allocates
+Value VM::concatenate(ObjString *a, ObjString *b)
 {
-    std::shared_ptr<ObjString> b = AS_STRING(pop());
-    std::shared_ptr<ObjString> a = AS_STRING(pop());
-
-    const int aLen = a->str.size();
-    const int bLen = b->str.size();
-
-    const int len = aLen + bLen;
-
-    char characters[len];
-
-    for (int i = 0; i < aLen; i++)
-    {
-        characters[i] = a->str.at(i);
-    }
-
-    for (int i = 0 ; i < bLen; i++)
-    {
-        characters[i + aLen] = b->str.at(i);
-    }
-
-    return OBJ_VAL(makeString(characters, len));
+    size_t length = a->length + b->length;
+    if (length >= ROPE_MIN_LENGTH)
+        return OBJ_VAL(makeRope(*this, a, b));
+
+    // a rope is never this short, so both operands have their characters
+    std::string chars;
+    chars.reserve(length);
+    chars.append(a->chars, a->length);
+    chars.append(b->chars, b->length);
+    return OBJ_VAL(makeString(*this, chars.data(), length));
 }
\ No newline at end of file
@@ -6,8 +6,14 @@
 #include "object.hh"
 #include "table.hh"
 #include "compiler.hh"
+#include "registervm.hh"
 
-#define STACK_MAX 256
+#define FRAMES_MAX 64
+#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+
+// Default number of back-edges of one loop, and of calls of one function, after which it is compiled to native code
+#define HOT_LOOP_THRESHOLD 1000
+#define HOT_CALL_THRESHOLD 1000
 
 enum InterpretResult
 {
@@ -20,42 +26,138 @@ class Hashing
 {
     public:
 
-    size_t operator()(const std::shared_ptr<ObjString> obj) const;
+    size_t operator()(ObjString *obj) const;
 };
 
+// Strings are interned so two keys are the same string exactly when they are the same object
 class Equality
 {
     public:
 
-    bool operator()(const std::shared_ptr<ObjString> obj1, const std::shared_ptr<ObjString> obj2) const
+    bool operator()(ObjString *obj1, ObjString *obj2) const
     {
-        return obj1->str == obj2->str;
+        return obj1 == obj2;
     }
 };
 
+/**
+
+    @brief Storage for one global variable. The compiler resolves every global name to an index into VM::globals, a slot
+    stays undefined until its 'var' declaration has run so reads and assignments before that still fail.
+    */
+struct Global
+{
+    Value value;
+    ObjString *name;
+    bool defined;
+};
+
+/**
+
+    @brief One active function call. Frames live in a fixed array inside the VM so a call never allocates, slots points
+    at the callee's own stack slot with its arguments and locals following it.
+    */
+struct CallFrame
+{
+    ObjFunction *function;
+    uint8_t *ip; // next instruction to run in function's chunk, only up to date while the frame is not running
+    const RegInstruction *registerIp; // the same for the function's register code, NULL if the interpreter runs it
+    Value *slots;
+};
+
 class VM
 {
 public:
-    Compiler compiler;
-    std::shared_ptr<ByteArray> bytearray = std::make_shared<ByteArray>();
-    std::vector<uint8_t>::iterator ip; // Instruction pointer which points to the current chunk being run
+    Compiler *compiler = nullptr; // the compile in progress, lives on compile()'s stack
+    CallFrame frames[FRAMES_MAX];
+    int frameCount;
     Value stack[STACK_MAX];
     Value *stackTop;
-    Table<std::shared_ptr<ObjString>, Value, Hashing, Equality> strings;
-    Table<std::shared_ptr<ObjString>, Value, Hashing, Equality> globals;
+    Table<ObjString *, Value, Hashing, Equality> strings;
+    Table<ObjString *, Value, Hashing, Equality> globalNames; // name -> index into globals
+    std::vector<Global> globals;
     Obj* objects;
 
+    // set from the command line, see main.cpp
+    bool traceExecution = false;
+    bool printCode = false;
+    bool useCache = true;
+    bool profileOpcodes = false;
+    bool registerVM = false;
+    bool jit = false;
+    bool tiering = true; // compile hot loops and functions to native code as the interpreter runs into them
+    int hotLoopThreshold = HOT_LOOP_THRESHOLD;
+    int hotCallThreshold = HOT_CALL_THRESHOLD;
+
+    bool runningRegisters = false; // whether new frames run register code, see call()
+    int returnDepth = 0;           // run() returns once a return leaves this many frames, see callInterpreter()
+
+    // how often each opcode ran right after another, indexed [previous * 256 + next], only kept with profileOpcodes
+    std::vector<uint64_t> opcodePairs;
+    int previousOpcode = -1;
+
+    // garbage collector state
+    size_t bytesAllocated;
+    size_t nextGC;
+    double gcGrowFactor;
+    std::vector<Obj *> grayStack;
+
     VM();
 
+    ~VM();
+
     void resetStack();
 
+    void freeObjects();
+
+    int globalSlot(ObjString *name);
+
     void runtimeError(const char *format, ...);
 
     // Reads and executes bytes
     InterpretResult run();
 
+    template <bool Instrumented>
+    InterpretResult execute();
+
+    void instrumentInstruction(CallFrame *frame);
+
+    void printOpcodeProfile();
+
+    bool prepareRegisters(ObjFunction *function);
+
+    Value *registerTop();
+
+    void clearRegisters(int argCount);
+
+    InterpretResult callInterpreter(ObjFunction *function, int argCount);
+
+    // The register VM's counterpart of execute(), see registervm.cpp
+    InterpretResult executeRegisters();
+
+    bool compileNative(ObjFunction *function);
+
+    bool prepareNative(ObjFunction *function);
+
+    bool hotLoop(ObjFunction *function, int header);
+
+    bool hotCall(ObjFunction *function);
+
+    // Runs the frame on top to its return in native code or on the interpreter, see jit.cpp
+    InterpretResult runFrame();
+
+    bool call(ObjFunction *function, int argCount);
+
+    bool callValue(Value callee, int argCount);
+
+    ObjFunction *compile(const char *source);
+
+    InterpretResult runFunction(ObjFunction *function);
+
     InterpretResult interpret(const char *source);
 
+    InterpretResult interpretFile(const char *path, const char *source);
+
     void push(Value value);
 
     Value pop();
@@ -64,9 +166,7 @@ public:
 
     bool isFalsey(Value value);
 
-    Value concatenate();
+    Value concatenate(ObjString *a, ObjString *b);
 };
 
-extern VM vm;
-
 #endif
\ No newline at end of file